@@ -58,8 +58,24 @@ static void load_from_file(GKeyFile *keyfile, const char *group, GError **error)
 
   ADD_KEYBOOL(sqlctx->ansi_npw, "ansi_npw");
   ADD_KEYBOOL(sqlctx->hotstart, "hot_start");
+  ADD_KEYBOOL(sqlctx->batchfetch, "batch_fetch");
+  ADD_KEYBOOL(sqlctx->snapshot, "snapshot");
 
   ADD_KEYINT(sqlctx->depltime, "deploy_time");
+  ADD_KEYINT(sqlctx->maxdepl, "deploy_max");
+  ADD_KEYINT(sqlctx->deplbatch, "deploy_batch");
+  ADD_KEYBOOL(sqlctx->deplparallel, "deploy_parallel");
+
+  ADD_KEYINT(sqlctx->negttl, "negative_ttl");
+  ADD_KEYINT(sqlctx->negsize, "negative_size");
+
+  ADD_KEYINT(sqlctx->schttl, "schema_ttl");
+  ADD_KEYINT(sqlctx->tblttl, "table_ttl");
+  ADD_KEYINT(sqlctx->modttl, "module_ttl");
+  ADD_KEYINT(sqlctx->colttl, "column_ttl");
+
+  ADD_KEYINT(sqlctx->polltime, "poll_time");
+  ADD_KEYINT(sqlctx->textcache, "text_cache");
 
   if (g_key_file_has_key(keyfile, group, "auth", &terr))
     sqlctx->auth = g_key_file_get_value(keyfile, group, "auth", &terr);
@@ -90,6 +106,7 @@ void init_keyfile(const char *profile, GError **error)
   g_key_file_load_from_file(keyfile, keyctx->filename, G_KEY_FILE_NONE, &terr);
 
   keyctx->sqlctx = g_try_new0(sqlctx_t, 1);
+  keyctx->sqlctx->profile = g_strdup(profile);
   if (terr == NULL) {
 
     if (g_key_file_has_group(keyfile, "global")) {
@@ -111,6 +128,11 @@ void init_keyfile(const char *profile, GError **error)
 
   g_key_file_free(keyfile);
 
+  // фильтр проверяется на каждый lookup, компилируется однажды
+  if (terr == NULL && keyctx->sqlctx->filter != NULL)
+    keyctx->sqlctx->filter_re = g_regex_new(keyctx->sqlctx->filter,
+					    G_REGEX_OPTIMIZE, 0, &terr);
+
   if (terr != NULL)
     g_propagate_error(error, terr);
 }
@@ -129,6 +151,9 @@ sqlctx_t * fetch_context(gboolean load_auth, GError **error)
   if (sqlctx->maxconn < 1)
     sqlctx->maxconn = 1;
 
+  if (sqlctx->negsize < 1)
+    sqlctx->negsize = 1024;
+
   if (load_auth && sqlctx->auth) {
     GError *terr = NULL;
     GKeyFile *keyfile = g_key_file_new();
@@ -182,6 +207,9 @@ void close_keyfile()
     if (sqlctx->appname != NULL)
       g_free(sqlctx->appname);
 
+    if (sqlctx->profile != NULL)
+      g_free(sqlctx->profile);
+
     if (sqlctx->servername != NULL)
       g_free(sqlctx->servername);
 
@@ -203,6 +231,9 @@ void close_keyfile()
     if (sqlctx->filter != NULL)
       g_free(sqlctx->filter);
 
+    if (sqlctx->filter_re != NULL)
+      g_regex_unref(sqlctx->filter_re);
+
     g_free(sqlctx);
   }
 
@@ -23,16 +23,22 @@
 #include <sqlfuse.h>
 
 typedef struct {
-  char *appname;
+  char *appname, *profile;
   char *servername, *dbname, *auth;
   char *username, *password;
   char *from_codeset, *to_codeset;
   char *filter;
   char **excl_sch;
+
+  // скомпилированный filter, только для чтения из разных потоков
+  GRegex *filter_re;
   
-  gboolean ansi_npw, hotstart;
+  gboolean ansi_npw, hotstart, batchfetch, snapshot, deplparallel;
   
-  int maxconn, debug, depltime, maxdepl;
+  int maxconn, debug, depltime, maxdepl, deplbatch;
+  int negttl, negsize;
+  int schttl, tblttl, modttl, colttl;
+  int polltime, textcache;
 } sqlctx_t;
 
 /*
@@ -20,9 +20,88 @@
 #include <sqlfuse.h>
 #include <conf/keyconf.h>
 
+#define FUSE_USE_VERSION 26
+#include <fuse_lowlevel.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+
+// время кэширования в ядре для объектов без *_ttl
+#define DEFAULT_TIMEOUT 1.0
+
+// число сегментов таблицы открытых файлов
+#define OPEN_SHARDS 16
+
+// предел числа атрибутов, запомненных при чтении директорий
+#define ATTR_LIMIT 65536
+
+// номер inode в записи директории, когда он ещё не известен
+#ifndef FUSE_UNKNOWN_INO
+#define FUSE_UNKNOWN_INO 0xffffffff
+#endif
+
+// наибольший размер одной записи, библиотека урезает его до своего буфера
+#define MAX_WRITE (1024 * 1024)
+
+/*
+ * Узел ядра: номер inode сопоставлен пути объекта.
+ * Живёт, пока ядро не вызовет forget на все свои lookup.
+ */
+struct sqlfs_inode {
+  fuse_ino_t ino;
+  fuse_ino_t parent;
+
+  gchar *name;
+  gchar *path;
+
+  // число ссылок ядра на узел
+  guint64 nlookup;
+
+  // текст модуля, общий для открытых дескрипторов
+  GBytes *text;
+
+  // размер файла, последний раз сообщённый ядру
+  off_t size;
+  gboolean sized;
+};
+
+/*
+ * Атрибуты объекта, полученные вместе со списком директории.
+ * Отвечают на следующий lookup без обращения к кэшу объектов.
+ */
+struct sqlfs_attr {
+  struct stat st;
+  guint64 ino;
+  double timeout;
+  gint64 expire;
+};
+
+/*
+ * Сегмент таблицы открытых файлов: дескриптор -> sqlfs_file_t
+ */
+struct sqlshard {
+  GMutex lock;
+  GHashTable *table;
+};
+
 struct sqlcache {
   GMutex m;
-  GHashTable *open_table;
+
+  // открытые файлы разбиты на сегменты по дескриптору,
+  // у каждого сегмента своя блокировка
+  struct sqlshard open_shards[OPEN_SHARDS];
+
+  // номер inode -> struct sqlfs_inode, путь -> struct sqlfs_inode
+  GHashTable *ino_table;
+  GHashTable *path_table;
+
+  // атрибуты из последнего чтения директорий: путь -> struct sqlfs_attr
+  GHashTable *attr_table;
+
+  // счётчики номеров inode объектов вне БД и дескрипторов открытых файлов
+  fuse_ino_t last_ino;
+  uint64_t last_fh;
 };
 
 struct sqlprofile {
@@ -32,16 +111,27 @@ struct sqlprofile {
 };
 
 typedef struct {
-  gchar *buffer;
+  uint64_t fh;
+
+  // чтение и запись одного дескриптора из разных потоков
+  GMutex lock;
+
+  // общий неизменяемый текст; собственная копия buffer заводится
+  // при первом изменении, длина хранится в буфере, содержимое может
+  // включать '\0'
+  GBytes *text;
+  GString *buffer;
   int flush;
 } sqlfs_file_t;
 
-#define FUSE_USE_VERSION 26
-#include <fuse.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <string.h>
-#include <stdlib.h>
+/*
+ * Содержимое директории в формате fuse_add_direntry,
+ * собирается при opendir и отдаётся частями в readdir
+ */
+typedef struct {
+  char *buffer;
+  size_t size;
+} sqlfs_dir_t;
 
 static struct sqlcache cache;
 static struct sqlprofile *sqlprofile;
@@ -72,454 +162,1258 @@ static int sqlfs_opt_proc(void * data, const char * arg, int key,
   }
 }
 
-static int sqlfs_getattr(const char *path, struct stat *stbuf)
+static void free_sqlfs_file(gpointer pointer)
+{
+  sqlfs_file_t *fsfile = (sqlfs_file_t *) pointer;
+  if (fsfile) {
+    if (fsfile->text)
+      g_bytes_unref(fsfile->text);
+
+    if (fsfile->buffer)
+      g_string_free(fsfile->buffer, TRUE);
+
+    g_mutex_clear(&fsfile->lock);
+    g_free(fsfile); 
+  }
+}
+
+/*
+ * Копия общего текста перед первым изменением
+ */
+static void own_text(sqlfs_file_t *fsfile)
+{
+  if (fsfile->buffer != NULL)
+    return ;
+
+  gsize len = 0;
+  const gchar *data = (fsfile->text) ? g_bytes_get_data(fsfile->text, &len)
+    : NULL;
+
+  fsfile->buffer = g_string_new_len(data, len);
+
+  if (fsfile->text != NULL) {
+    g_bytes_unref(fsfile->text);
+    fsfile->text = NULL;
+  }
+}
+
+/*
+ * Изменить длину текста, новые байты заполняются нулями
+ */
+static void resize_file(sqlfs_file_t *fsfile, gsize len)
+{
+  own_text(fsfile);
+
+  gsize oldlen = fsfile->buffer->len;
+
+  g_string_set_size(fsfile->buffer, len);
+  if (len > oldlen)
+    memset(fsfile->buffer->str + oldlen, 0, len - oldlen);
+}
+
+static inline struct sqlshard * get_shard(uint64_t fh)
+{
+  return &cache.open_shards[fh % OPEN_SHARDS];
+}
+
+/*
+ * Зарегистрировать открытый файл под новым дескриптором
+ */
+static uint64_t put_file(sqlfs_file_t *fsfile)
+{
+  g_mutex_lock(&cache.m);
+  fsfile->fh = ++cache.last_fh;
+  g_mutex_unlock(&cache.m);
+
+  struct sqlshard *shard = get_shard(fsfile->fh);
+  g_mutex_lock(&shard->lock);
+  g_hash_table_insert(shard->table, &fsfile->fh, fsfile);
+  g_mutex_unlock(&shard->lock);
+
+  return fsfile->fh;
+}
+
+/*
+ * Ядро не присылает release, пока по дескриптору идут другие запросы,
+ * поэтому файл можно использовать после снятия блокировки сегмента
+ */
+static sqlfs_file_t * get_file(uint64_t fh)
+{
+  struct sqlshard *shard = get_shard(fh);
+
+  g_mutex_lock(&shard->lock);
+  sqlfs_file_t *fsfile = g_hash_table_lookup(shard->table, &fh);
+  g_mutex_unlock(&shard->lock);
+
+  return fsfile;
+}
+
+static void remove_file(uint64_t fh)
+{
+  struct sqlshard *shard = get_shard(fh);
+
+  g_mutex_lock(&shard->lock);
+  g_hash_table_remove(shard->table, &fh);
+  g_mutex_unlock(&shard->lock);
+}
+
+static void free_sqlfs_inode(gpointer pointer)
+{
+  struct sqlfs_inode *inode = (struct sqlfs_inode *) pointer;
+  if (inode) {
+    if (inode->name)
+      g_free(inode->name);
+
+    if (inode->path)
+      g_free(inode->path);
+
+    if (inode->text)
+      g_bytes_unref(inode->text);
+
+    g_free(inode);
+  }
+}
+
+static gchar * make_path(const char *parent, const char *name)
+{
+  if (g_strcmp0(parent, G_DIR_SEPARATOR_S) == 0)
+    return g_strconcat(G_DIR_SEPARATOR_S, name, NULL);
+
+  return g_strconcat(parent, G_DIR_SEPARATOR_S, name, NULL);
+}
+
+/*
+ * Путь по номеру inode, NULL - ядро ссылается на забытый узел
+ */
+static gchar * get_inode_path(fuse_ino_t ino)
+{
+  gchar *path = NULL;
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.ino_table,
+						   GSIZE_TO_POINTER(ino));
+  if (inode != NULL)
+    path = g_strdup(inode->path);
+  g_mutex_unlock(&cache.m);
+
+  return path;
+}
+
+/*
+ * Номер inode родительской директории, у корня - сам корень
+ */
+static fuse_ino_t get_parent_ino(fuse_ino_t ino)
+{
+  fuse_ino_t parent = FUSE_ROOT_ID;
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.ino_table,
+						   GSIZE_TO_POINTER(ino));
+  if (inode != NULL && inode->parent != 0)
+    parent = inode->parent;
+  g_mutex_unlock(&cache.m);
+
+  return parent;
+}
+
+/*
+ * Номер inode для записи директории: выданный ядру при lookup,
+ * иначе стабильный номер объекта, иначе FUSE_UNKNOWN_INO
+ */
+static fuse_ino_t get_dirent_ino(const char *path, guint64 stable)
+{
+  fuse_ino_t ino = FUSE_UNKNOWN_INO;
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.path_table, path);
+  if (inode != NULL)
+    ino = inode->ino;
+  else
+    if (stable && sizeof(fuse_ino_t) >= sizeof(guint64))
+      ino = (fuse_ino_t) stable;
+  g_mutex_unlock(&cache.m);
+
+  return ino;
+}
+
+/*
+ * Путь дочернего объекта по номеру inode директории
+ */
+static gchar * get_child_path(fuse_ino_t parent, const char *name)
+{
+  gchar *path = NULL;
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.ino_table,
+						   GSIZE_TO_POINTER(parent));
+  if (inode != NULL)
+    path = make_path(inode->path, name);
+  g_mutex_unlock(&cache.m);
+
+  return path;
+}
+
+/*
+ * Общий текст модуля для дескриптора: берётся у inode, пока только что
+ * прочитанный текст совпадает с ним побайтно, иначе def становится
+ * новым общим текстом. unchanged - текст тот же, что при прошлом открытии.
+ */
+static GBytes * share_text(fuse_ino_t ino, const char *def,
+			   gboolean *unchanged)
+{
+  GBytes *text = NULL;
+  gsize len = strlen(def);
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.ino_table,
+						   GSIZE_TO_POINTER(ino));
+  if (inode != NULL && inode->text != NULL
+      && g_bytes_get_size(inode->text) == len
+      && !memcmp(g_bytes_get_data(inode->text, NULL), def, len))
+    text = g_bytes_ref(inode->text);
+  g_mutex_unlock(&cache.m);
+
+  *unchanged = (text != NULL);
+  if (text != NULL)
+    return text;
+
+  text = g_bytes_new(def, len);
+
+  g_mutex_lock(&cache.m);
+  inode = g_hash_table_lookup(cache.ino_table, GSIZE_TO_POINTER(ino));
+  if (inode != NULL) {
+    if (inode->text != NULL)
+      g_bytes_unref(inode->text);
+
+    inode->text = g_bytes_ref(text);
+  }
+  g_mutex_unlock(&cache.m);
+
+  return text;
+}
+
+/*
+ * Текст модуля изменён через ФС, общая копия больше не годится
+ */
+static void drop_text(fuse_ino_t ino)
+{
+  g_mutex_lock(&cache.m);
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.ino_table,
+						   GSIZE_TO_POINTER(ino));
+  if (inode != NULL && inode->text != NULL) {
+    g_bytes_unref(inode->text);
+    inode->text = NULL;
+  }
+  g_mutex_unlock(&cache.m);
+}
+
+/*
+ * Найти или завести inode для пути и учесть ссылку ядра. Объекту БД
+ * достаётся постоянный номер, остальным - следующий номер счётчика.
+ */
+static fuse_ino_t ref_inode(fuse_ino_t parent, const char *name,
+			    const char *path, guint64 stable)
+{
+  g_mutex_lock(&cache.m);
+
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.path_table, path);
+
+  // объект пересоздан под тем же именем
+  if (inode != NULL && stable && inode->ino != stable
+      && sizeof(fuse_ino_t) >= sizeof(guint64)) {
+    g_hash_table_remove(cache.path_table, path);
+    inode = NULL;
+  }
+
+  if (inode == NULL) {
+    fuse_ino_t ino = 0;
+
+    if (stable && sizeof(fuse_ino_t) >= sizeof(guint64)
+	&& !g_hash_table_contains(cache.ino_table, GSIZE_TO_POINTER(stable)))
+      ino = (fuse_ino_t) stable;
+    else
+      ino = ++cache.last_ino;
+
+    inode = g_try_new0(struct sqlfs_inode, 1);
+    inode->ino = ino;
+    inode->parent = parent;
+    inode->name = g_strdup(name);
+    inode->path = g_strdup(path);
+
+    g_hash_table_insert(cache.ino_table, GSIZE_TO_POINTER(inode->ino),
+			inode);
+    g_hash_table_insert(cache.path_table, inode->path, inode);
+  }
+  inode->nlookup++;
+
+  fuse_ino_t ino = inode->ino;
+  g_mutex_unlock(&cache.m);
+
+  return ino;
+}
+
+static void forget_inode(fuse_ino_t ino, unsigned long nlookup)
+{
+  if (ino == FUSE_ROOT_ID)
+    return ;
+
+  g_mutex_lock(&cache.m);
+
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.ino_table,
+						   GSIZE_TO_POINTER(ino));
+  if (inode != NULL) {
+    inode->nlookup = (inode->nlookup > nlookup) ? inode->nlookup - nlookup : 0;
+
+    if (!inode->nlookup) {
+      // путь мог достаться другому узлу после удаления/переименования
+      if (g_hash_table_lookup(cache.path_table, inode->path) == inode)
+	g_hash_table_remove(cache.path_table, inode->path);
+
+      g_hash_table_remove(cache.ino_table, GSIZE_TO_POINTER(ino));
+    }
+  }
+
+  g_mutex_unlock(&cache.m);
+}
+
+/*
+ * Отвязать путь от inode: объект удалён, номер живёт до forget
+ */
+static void unlink_inode(const char *path)
+{
+  g_mutex_lock(&cache.m);
+  g_hash_table_remove(cache.path_table, path);
+  g_hash_table_remove(cache.attr_table, path);
+  g_mutex_unlock(&cache.m);
+}
+
+/*
+ * Перенести узлы объекта и вложенных объектов на новый путь
+ */
+static void rename_inode(const char *oldpath, fuse_ino_t newparent,
+			 const char *newname, const char *newpath)
+{
+  g_mutex_lock(&cache.m);
+
+  g_hash_table_remove(cache.path_table, newpath);
+  g_hash_table_remove_all(cache.attr_table);
+
+  gsize oldlen = strlen(oldpath);
+  GList *moved = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init(&iter, cache.path_table);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    struct sqlfs_inode *inode = (struct sqlfs_inode *) value;
+
+    if (g_str_has_prefix(inode->path, oldpath)
+	&& (inode->path[oldlen] == '\0'
+	    || inode->path[oldlen] == G_DIR_SEPARATOR)) {
+      g_hash_table_iter_steal(&iter);
+      moved = g_list_prepend(moved, inode);
+    }
+  }
+
+  GList *wrk = moved;
+  while (wrk) {
+    struct sqlfs_inode *inode = (struct sqlfs_inode *) wrk->data;
+    gchar *path = g_strconcat(newpath, inode->path + oldlen, NULL);
+
+    g_free(inode->path);
+    inode->path = path;
+
+    // при переименовании сервер может переписать текст модуля
+    if (inode->text != NULL) {
+      g_bytes_unref(inode->text);
+      inode->text = NULL;
+    }
+
+    if (path[strlen(newpath)] == '\0') {
+      g_free(inode->name);
+      inode->name = g_strdup(newname);
+      inode->parent = newparent;
+    }
+
+    g_hash_table_insert(cache.path_table, inode->path, inode);
+    wrk = g_list_next(wrk);
+  }
+  g_list_free(moved);
+
+  g_mutex_unlock(&cache.m);
+}
+
+static inline double get_timeout(struct sqlfs_object *object)
+{
+  return (object != NULL && object->ttl > 0) ? object->ttl : DEFAULT_TIMEOUT;
+}
+
+static void fill_stat(struct sqlfs_object *object, fuse_ino_t ino,
+		      struct stat *stbuf)
+{
+  memset(stbuf, 0, sizeof(struct stat));
+
+  if (object == NULL || object->type == SF_DIR) {
+    stbuf->st_mode = S_IFDIR | 0755;
+    stbuf->st_nlink = 2;
+  } else {
+    stbuf->st_mode = S_IFREG | 0666;
+    stbuf->st_nlink = 1;
+    stbuf->st_size = object->len;
+  }
+
+  if (object != NULL)
+    stbuf->st_mtime = object->mtime;
+
+  stbuf->st_ino = ino;
+  stbuf->st_uid = sqlprofile->uid;
+  stbuf->st_gid = sqlprofile->gid;
+}
+
+/*
+ * Запомнить атрибуты объекта из списка директории
+ */
+static void prime_attr(const char *path, struct sqlfs_object *object)
+{
+  struct sqlfs_attr *attr = g_try_new0(struct sqlfs_attr, 1);
+
+  fill_stat(object, 0, &attr->st);
+  attr->ino = object->ino;
+  attr->timeout = get_timeout(object);
+  attr->expire = g_get_monotonic_time() + attr->timeout * G_USEC_PER_SEC;
+
+  g_mutex_lock(&cache.m);
+  g_hash_table_replace(cache.attr_table, g_strdup(path), attr);
+  g_mutex_unlock(&cache.m);
+}
+
+/*
+ * Изъять ещё годные атрибуты объекта, NULL - их нет
+ */
+static struct sqlfs_attr * take_attr(const char *path)
+{
+  gpointer key = NULL, value = NULL;
+  struct sqlfs_attr *attr = NULL;
+
+  g_mutex_lock(&cache.m);
+  if (g_hash_table_lookup_extended(cache.attr_table, path, &key, &value)) {
+    g_hash_table_steal(cache.attr_table, path);
+    g_free(key);
+    attr = (struct sqlfs_attr *) value;
+  }
+  g_mutex_unlock(&cache.m);
+
+  if (attr != NULL && attr->expire < g_get_monotonic_time()) {
+    g_free(attr);
+    attr = NULL;
+  }
+
+  return attr;
+}
+
+static inline gboolean is_filtered(const char *path)
+{
+  GRegex *filter = get_context()->filter_re;
+
+  return (filter != NULL && g_regex_match(filter, path, 0, NULL));
+}
+
+static int error2errno(GError *terr)
+{
+  switch(terr->code) {
+  case EENOTFOUND:
+    return ENOENT;
+  case EENOTSUP:
+    return ENOTSUP;
+  case EERES:
+    return ECONNABORTED;
+  default:
+    return EFAULT;
+  }
+}
+
+/*
+ * Запомнить размер файла, сообщаемый ядру. Длина 0 из списка директории
+ * не известна, тогда сообщается длина общего текста inode, если он есть.
+ */
+static void note_size(fuse_ino_t ino, struct stat *stbuf)
+{
+  if (!S_ISREG(stbuf->st_mode))
+    return ;
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.ino_table,
+						   GSIZE_TO_POINTER(ino));
+  if (inode != NULL) {
+    if (stbuf->st_size == 0 && inode->text != NULL)
+      stbuf->st_size = g_bytes_get_size(inode->text);
+
+    inode->size = stbuf->st_size;
+    inode->sized = TRUE;
+  }
+  g_mutex_unlock(&cache.m);
+}
+
+/*
+ * Размер файла не совпадает с известным ядру
+ */
+static gboolean is_resized(fuse_ino_t ino, gsize size)
+{
+  gboolean res = FALSE;
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_inode *inode = g_hash_table_lookup(cache.ino_table,
+						   GSIZE_TO_POINTER(ino));
+  if (inode != NULL && inode->sized)
+    res = (inode->size != (off_t) size);
+  g_mutex_unlock(&cache.m);
+
+  return res;
+}
+
+/*
+ * Ответить ядру записью объекта и учесть ссылку на inode
+ */
+static void reply_entry(fuse_req_t req, fuse_ino_t parent, const char *name,
+			const char *path, gboolean primed)
+{
+  struct fuse_entry_param e;
+  memset(&e, 0, sizeof(e));
+
+  // объект только что был в списке директории
+  struct sqlfs_attr *attr = (primed) ? take_attr(path) : NULL;
+  if (attr != NULL) {
+    e.ino = ref_inode(parent, name, path, attr->ino);
+    e.attr_timeout = attr->timeout;
+    e.entry_timeout = e.attr_timeout;
+    e.attr = attr->st;
+    e.attr.st_ino = e.ino;
+    note_size(e.ino, &e.attr);
+
+    g_free(attr);
+
+    if (fuse_reply_entry(req, &e) != 0)
+      forget_inode(e.ino, 1);
+    return ;
+  }
+
+  GError *terr = NULL;
+  struct sqlfs_object *object = find_object(path, &terr);
+
+  if (terr != NULL) {
+    fuse_reply_err(req, (terr->code == EENOTFOUND) ? ENOENT : EFAULT);
+    g_error_free(terr);
+    return ;
+  }
+
+  e.ino = ref_inode(parent, name, path, object->ino);
+  e.attr_timeout = get_timeout(object);
+  e.entry_timeout = e.attr_timeout;
+  fill_stat(object, e.ino, &e.attr);
+  note_size(e.ino, &e.attr);
+
+  free_sqlfs_object(object);
+
+  if (fuse_reply_entry(req, &e) != 0)
+    forget_inode(e.ino, 1);
+}
+
+static void sqlfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+  gchar *path = get_child_path(parent, name);
+
+  if (path == NULL)
+    fuse_reply_err(req, ENOENT);
+  else
+    if (is_filtered(path))
+      fuse_reply_err(req, ENOENT);
+    else
+      reply_entry(req, parent, name, path, TRUE);
+
+  g_free(path);
+}
+
+static void sqlfs_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+  forget_inode(ino, nlookup);
+  fuse_reply_none(req);
+}
+
+#if FUSE_VERSION >= 29
+static void sqlfs_forget_multi(fuse_req_t req, size_t count,
+			       struct fuse_forget_data *forgets)
+{
+  size_t i;
+  for (i = 0; i < count; i++)
+    forget_inode(forgets[i].ino, forgets[i].nlookup);
+
+  fuse_reply_none(req);
+}
+#endif
+
+static void sqlfs_getattr(fuse_req_t req, fuse_ino_t ino,
+			  struct fuse_file_info *fi)
+{
+  struct stat stbuf;
+
+  if (ino == FUSE_ROOT_ID) {
+    fill_stat(NULL, ino, &stbuf);
+    fuse_reply_attr(req, &stbuf, DEFAULT_TIMEOUT);
+    return ;
+  }
+
+  gchar *path = get_inode_path(ino);
+  if (path == NULL) {
+    fuse_reply_err(req, ENOENT);
+    return ;
+  }
+
+  GError *terr = NULL;
+  struct sqlfs_object *object = find_object(path, &terr);
+  if (terr != NULL) {
+    fuse_reply_err(req, ENOENT);
+    g_error_free(terr);
+  }
+  else {
+    fill_stat(object, ino, &stbuf);
+    note_size(ino, &stbuf);
+    fuse_reply_attr(req, &stbuf, get_timeout(object));
+    free_sqlfs_object(object);
+  }
+
+  g_free(path);
+}
+
+static void sqlfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+			  int to_set, struct fuse_file_info *fi)
+{
+  // права, владелец и время изменения не хранятся
+  if (to_set & FUSE_SET_ATTR_SIZE) {
+    gchar *path = get_inode_path(ino);
+    GError *terr = NULL;
+
+    if (path == NULL)
+      g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		  "%d: Inode not found\n", __LINE__);
+    else
+      truncate_object(path, attr->st_size, &terr);
+
+    g_free(path);
+    drop_text(ino);
+
+    // ftruncate: открытый текст должен совпасть с обрезанным,
+    // иначе flush вернёт прежний хвост
+    sqlfs_file_t *fsfile = (fi != NULL && terr == NULL)
+      ? get_file(fi->fh) : NULL;
+    if (fsfile != NULL) {
+      g_mutex_lock(&fsfile->lock);
+      resize_file(fsfile, attr->st_size);
+      g_mutex_unlock(&fsfile->lock);
+    }
+
+    if (terr != NULL) {
+      fuse_reply_err(req, (terr->code == EENOTFOUND) ? ENOENT : EFAULT);
+      g_error_free(terr);
+      return ;
+    }
+  }
+
+  sqlfs_getattr(req, ino, fi);
+}
+
+static void add_dir_entry(sqlfs_dir_t *dir, fuse_req_t req, const char *name,
+			  struct stat *stbuf)
+{
+  size_t oldsize = dir->size;
+  dir->size += fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+  dir->buffer = g_realloc(dir->buffer, dir->size);
+  fuse_add_direntry(req, dir->buffer + oldsize, dir->size - oldsize, name,
+		    stbuf, dir->size);
+}
+
+static void free_sqlfs_dir(sqlfs_dir_t *dir)
 {
-  int err = 0;
+  if (dir) {
+    if (dir->buffer)
+      g_free(dir->buffer);
 
-  char *filter = get_context()->filter;
-  if (filter != NULL && g_regex_match_simple(filter, path, 0, 0)) {
-    return -ENOENT;
+    g_free(dir);
   }
+}
 
-  memset(stbuf, 0, sizeof(struct stat));
-  
-  if (g_strcmp0(path, G_DIR_SEPARATOR_S) == 0) {
-    stbuf->st_mode = S_IFDIR | 0755;
-    stbuf->st_nlink = 2;
-  } else {
-    GError *terr = NULL;
-    struct sqlfs_object *object = find_object(path, &terr);
-    if (terr != NULL) {
-      err = -ENOENT;
-    }
-    else {
-      if (object->type == SF_DIR) {
-	stbuf->st_mode = S_IFDIR | 0755;
-	stbuf->st_nlink = 2;
-      } else {
-	stbuf->st_mode = S_IFREG | 0666;
-	stbuf->st_nlink = 1;
-	stbuf->st_size = object->len;
-      }
-      stbuf->st_mtime = object->mtime;
-      stbuf->st_ino = object->object_id;
-      
-      if (object != NULL)
-	free_sqlfs_object(object);
-    }
-    
-    if (terr != NULL)
-      g_error_free(terr);
+static void sqlfs_opendir(fuse_req_t req, fuse_ino_t ino,
+			  struct fuse_file_info *fi)
+{
+  gchar *path = get_inode_path(ino);
+  if (path == NULL) {
+    fuse_reply_err(req, ENOENT);
+    return ;
   }
 
-  stbuf->st_uid = sqlprofile->uid;
-  stbuf->st_gid = sqlprofile->gid;
-
-  return err;
-}
+  struct stat stbuf;
+  sqlfs_dir_t *dir = g_try_new0(sqlfs_dir_t, 1);
 
-static int sqlfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-			 off_t offset, struct fuse_file_info *fi)
-{
-  filler(buf, ".", NULL, 0);
-  filler(buf, "..", NULL, 0);
+  fill_stat(NULL, ino, &stbuf);
+  add_dir_entry(dir, req, ".", &stbuf);
+  // glibc пропускает записи с d_ino == 0
+  fill_stat(NULL, get_parent_ino(ino), &stbuf);
+  add_dir_entry(dir, req, "..", &stbuf);
 
   GError *terr = NULL;
-  int err = 0;
-
-  GList *wrk = fetch_dir_objects(path, &terr);
-  if (terr == NULL && wrk) {
-    wrk = g_list_first(wrk);
-    while (wrk) {
-      struct sqlfs_object *object = wrk->data;
-      filler(buf, object->name, NULL, 0);
-      wrk = g_list_next(wrk);
+  GList *list = fetch_dir_objects(path, &terr);
+
+  g_mutex_lock(&cache.m);
+  if (g_hash_table_size(cache.attr_table) > ATTR_LIMIT)
+    g_hash_table_remove_all(cache.attr_table);
+  g_mutex_unlock(&cache.m);
+
+  // в FUSE 2 нет readdirplus: атрибуты отдаются в записях директории
+  // и запоминаются для последующих lookup
+  GList *wrk = g_list_first(list);
+  while (wrk) {
+    struct sqlfs_object *object = wrk->data;
+
+    // скрытые фильтром объекты не видны и в списке директории
+    gchar *child = make_path(path, object->name);
+    if (!is_filtered(child)) {
+      fill_stat(object, get_dirent_ino(child, object->ino), &stbuf);
+      add_dir_entry(dir, req, object->name, &stbuf);
+      prime_attr(child, object);
     }
-    wrk = g_list_first(wrk);
-    g_list_free_full(wrk, &free_sqlfs_object);
+    g_free(child);
+
+    wrk = g_list_next(wrk);
   }
-  else
-    if (terr != NULL && terr->code == EERES) {
-      err = -ECONNABORTED;
-    }
-  
+  g_list_free_full(list, &free_sqlfs_object);
+
+  g_free(path);
+
+  if (terr != NULL && terr->code == EERES) {
+    free_sqlfs_dir(dir);
+    fuse_reply_err(req, ECONNABORTED);
+  }
+  else {
+    fi->fh = (uint64_t) (uintptr_t) dir;
+    if (fuse_reply_open(req, fi) != 0)
+      free_sqlfs_dir(dir);
+  }
+
   if (terr != NULL)
     g_error_free(terr);
-  
-  return err;
 }
 
-static int sqlfs_read(const char *path, char *buf, size_t size,
-		      off_t offset, struct fuse_file_info *fi)
+static void sqlfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+			  off_t offset, struct fuse_file_info *fi)
 {
-  sqlfs_file_t *fsfile = g_hash_table_lookup(cache.open_table, &(fi->fh));
-  if (!fsfile || !fsfile->buffer)
-    return 0;
-  
-  size_t len = strlen(fsfile->buffer);
-  if (len < 1)
-    return 0;
-  
-  if (offset < len) {
-    if (offset + size > len)
-      size = len - offset;
-    memcpy(buf, fsfile->buffer + offset, size);
-  } else
-    size = 0;
+  sqlfs_dir_t *dir = (sqlfs_dir_t *) (uintptr_t) fi->fh;
 
-  return size;
+  if (dir != NULL && offset < dir->size)
+    fuse_reply_buf(req, dir->buffer + offset,
+		   MIN(dir->size - offset, size));
+  else
+    fuse_reply_buf(req, NULL, 0);
 }
 
-static int sqlfs_chmod(const char *path, mode_t mode)
+static void sqlfs_releasedir(fuse_req_t req, fuse_ino_t ino,
+			     struct fuse_file_info *fi)
 {
-  int err = 0;
-
-  return err;
+  free_sqlfs_dir((sqlfs_dir_t *) (uintptr_t) fi->fh);
+  fuse_reply_err(req, 0);
 }
 
-static int sqlfs_chown(const char *path, uid_t uid, gid_t gid)
+static void sqlfs_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+		       off_t offset, struct fuse_file_info *fi)
 {
-  int err = 0;
+  sqlfs_file_t *fsfile = get_file(fi->fh);
+  if (!fsfile) {
+    fuse_reply_buf(req, NULL, 0);
+    return ;
+  }
 
-  return err;
-}
+  g_mutex_lock(&fsfile->lock);
 
-static int sqlfs_utime(const char *path, struct utimbuf* time)
-{
-  (void) path;
-  (void) time;
+  // ответ отправляется ядру прямо из буфера, без промежуточной копии
+  gsize len = 0;
+  const gchar *data = NULL;
+  if (fsfile->buffer != NULL) {
+    data = fsfile->buffer->str;
+    len = fsfile->buffer->len;
+  }
+  else
+    if (fsfile->text != NULL)
+      data = g_bytes_get_data(fsfile->text, &len);
   
-  return 0;
+  if (offset < len) {
+    if (offset + size > len)
+      size = len - offset;
+    fuse_reply_buf(req, data + offset, size);
+  } else
+    fuse_reply_buf(req, NULL, 0);
+
+  g_mutex_unlock(&fsfile->lock);
 }
 
-static int sqlfs_mkdir(const char *path, mode_t mode)
+static void sqlfs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+			mode_t mode)
 {
-  int err = 0;
-  
-  if (S_ISDIR(mode))
-    return -EPERM;
-  
+  gchar *path = get_child_path(parent, name);
   GError *terr = NULL;
-  
-  create_dir(path, &terr);
+
+  if (path == NULL)
+    g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		"%d: Inode not found\n", __LINE__);
+  else
+    create_dir(path, &terr);
   
   if (terr != NULL) {
     if (terr->code == EENOTSUP)
-      err = -ENOTSUP;
+      fuse_reply_err(req, ENOTSUP);
     else
-      err = -EFAULT;
-  }
-  
-  if (terr != NULL)
+      fuse_reply_err(req, (terr->code == EENOTFOUND) ? ENOENT : EFAULT);
+
     g_error_free(terr);
+  }
+  else
+    reply_entry(req, parent, name, path, FALSE);
 
-  return err;
+  g_free(path);
 }
 
-static int sqlfs_rmdir(const char *path)
+static void sqlfs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
-  int err = 0;
+  gchar *path = get_child_path(parent, name);
   GError *terr = NULL;
 
-  remove_object(path, &terr);
-
-  if (terr != NULL)
-    err = -EFAULT;
+  if (path == NULL)
+    g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		"%d: Inode not found\n", __LINE__);
+  else
+    remove_object(path, &terr);
 
-  if (terr != NULL)
+  if (terr != NULL) {
+    fuse_reply_err(req, (terr->code == EENOTFOUND) ? ENOENT : EFAULT);
     g_error_free(terr);
+  }
+  else {
+    unlink_inode(path);
+    fuse_reply_err(req, 0);
+  }
 
-  return err;
+  g_free(path);
 }
 
-static int sqlfs_mknod(const char *path, mode_t mode, dev_t rdev)
+static void sqlfs_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+			mode_t mode, dev_t rdev)
 {
-  int err = 0;
-
-  if ((mode & S_IFMT) != S_IFREG)
-    return -EPERM;
+  if ((mode & S_IFMT) != S_IFREG) {
+    fuse_reply_err(req, EPERM);
+    return ;
+  }
 
+  gchar *path = get_child_path(parent, name);
   GError *terr = NULL;
-  create_node(path, &terr);
 
-  sqlfs_chmod(path, mode);
-
-  if (terr != NULL)
-    err = -EFAULT;
+  if (path == NULL)
+    g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		"%d: Inode not found\n", __LINE__);
+  else
+    create_node(path, &terr);
 
-  if (terr != NULL)
+  if (terr != NULL) {
+    fuse_reply_err(req, (terr->code == EENOTFOUND) ? ENOENT : EFAULT);
     g_error_free(terr);
-    
-  return err;
+  }
+  else
+    reply_entry(req, parent, name, path, FALSE);
+
+  g_free(path);
 }
 
-static int sqlfs_open(const char *path, struct fuse_file_info *fi)
+static void sqlfs_open(fuse_req_t req, fuse_ino_t ino,
+		       struct fuse_file_info *fi)
 {
   int err = 0;
 
+  gchar *path = get_inode_path(ino);
+  if (path == NULL) {
+    fuse_reply_err(req, ENOENT);
+    return ;
+  }
+
   GError *terr = NULL;
   struct sqlfs_object *object = find_object(path, &terr);
-  if (terr != NULL && terr->code == EENOTFOUND) {
-    err = -ENOENT;
+  if (terr != NULL) {
+    err = (terr->code == EENOTFOUND) ? ENOENT : EFAULT;
   }
-  
-  if ((fi->flags & O_ACCMODE) == O_RDONLY) {
-    if (fi->flags & O_CREAT) {
-      err = sqlfs_mknod(path, 07777 | S_IFREG, 0);
-    }
-  } else {
-    if ((fi->flags & O_ACCMODE) == O_RDWR
-	|| (fi->flags & O_ACCMODE) == O_WRONLY) {
-      if ((fi->flags & O_EXCL) && object->object_id)
-	err = -EACCES;
-    }
-    else {
-      err = -EIO;
-    }
+  else {
+    // O_CREAT и O_EXCL обрабатывает ядро через lookup и mknod
+    if ((fi->flags & O_ACCMODE) != O_RDONLY
+	&& (fi->flags & O_ACCMODE) != O_RDWR
+	&& (fi->flags & O_ACCMODE) != O_WRONLY)
+      err = EIO;
   }
   
   if (!err) {
-    // FIXME: Не надёжная генерация уникальных значений
-    fi->fh = object->object_id + g_get_monotonic_time();
-    
     char *def = fetch_object_text(path, &terr);
-    if (def != NULL) {
+    if (terr != NULL)
+      err = (terr->code == EENOTFOUND) ? ENOENT : EFAULT;
+
+    if (!err && def != NULL) {
       sqlfs_file_t *fsfile = g_try_new0(sqlfs_file_t, 1);
-      uint64_t *pfh = g_malloc0(sizeof(uint64_t));
-      *pfh = fi->fh;
-      if (def) {
-	fsfile->buffer = g_strdup(def);
-      }
+      g_mutex_init(&fsfile->lock);
+      gboolean unchanged = FALSE;
+      fsfile->text = share_text(ino, def, &unchanged);
+
+      // ядро знает прежний размер файла, читать до фактического конца
+      if (is_resized(ino, g_bytes_get_size(fsfile->text)))
+	fi->direct_io = 1;
 
-      g_hash_table_insert(cache.open_table, pfh, fsfile);
+      // страницы неизменённого текста в ядре остаются годными, иначе
+      // без keep_cache ядро сбрасывает кэш страниц inode при открытии
+      if (!fi->direct_io)
+	fi->keep_cache = unchanged;
+
+      fi->fh = put_file(fsfile);
     }
 
-    if (object != NULL)
-      free_sqlfs_object(object);
+    g_free(def);
   }
 
+  if (object != NULL)
+    free_sqlfs_object(object);
+
   if (terr != NULL)
     g_error_free(terr);
-  
-  return err;
+
+  g_free(path);
+
+  if (err)
+    fuse_reply_err(req, err);
+  else
+    if (fuse_reply_open(req, fi) != 0)
+      remove_file(fi->fh);
 }
 
-static int sqlfs_write(const char *path, const char *buf, size_t size,
-		       off_t offset, struct fuse_file_info *fi)
+static void sqlfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+			size_t size, off_t offset, struct fuse_file_info *fi)
 {
-  int err = 0;
-  sqlfs_file_t *fsfile = g_hash_table_lookup(cache.open_table, &(fi->fh));
-
-  if (fsfile && fsfile->buffer) {
-    size_t len = strlen(fsfile->buffer);
-    if (len < size + offset)
-      fsfile->buffer = g_realloc_n(fsfile->buffer, size + offset + 1,
-				   sizeof(gchar ));
-    g_strlcpy(fsfile->buffer + offset, buf, size + 1);
-    err = size;
+  sqlfs_file_t *fsfile = get_file(fi->fh);
+  if (fsfile != NULL)
+    g_mutex_lock(&fsfile->lock);
+
+  if (fsfile) {
+    own_text(fsfile);
+
+    // буфер растёт с запасом, запись стоит O(size)
+    if (offset > fsfile->buffer->len)
+      resize_file(fsfile, offset);
+
+    g_string_overwrite_len(fsfile->buffer, offset, buf, size);
     fsfile->flush = TRUE;
+
+    fuse_reply_write(req, size);
   }
   else
-    err = -ENOENT;
+    fuse_reply_err(req, ENOENT);
 
-  return err;
+  if (fsfile != NULL)
+    g_mutex_unlock(&fsfile->lock);
 }
 
-static int sqlfs_flush(const char *path, struct fuse_file_info *fi)
+/*
+ * Записать изменённый буфер дескриптора в кэш объектов
+ */
+static int flush_file(fuse_ino_t ino, struct fuse_file_info *fi)
 {
   int err = 0;
-  sqlfs_file_t *fsfile = g_hash_table_lookup(cache.open_table, &(fi->fh));
-  if (!fsfile)
-    return err;
+  sqlfs_file_t *fsfile = get_file(fi->fh);
+  if (fsfile != NULL)
+    g_mutex_lock(&fsfile->lock);
 
-  if (!err) {
+  if (fsfile != NULL && fsfile->flush == TRUE
+      && fsfile->buffer->len > 0) {
     GError *terr = NULL;
-    if (fsfile->flush == TRUE && strlen(fsfile->buffer) > 0) {
-      write_object(path, fsfile->buffer, &terr);
-      fsfile->flush = FALSE;
-    }
+    gchar *path = get_inode_path(ino);
+
+    if (path == NULL)
+      g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		  "%d: Inode not found\n", __LINE__);
+    else
+      write_object(path, fsfile->buffer->str, &terr);
+
+    fsfile->flush = FALSE;
+    drop_text(ino);
+    g_free(path);
 
     if (terr != NULL)
-      err = -EFAULT;
+      err = EFAULT;
 
     if (terr != NULL)
       g_error_free(terr);
   }
 
+  if (fsfile != NULL)
+    g_mutex_unlock(&fsfile->lock);
+
   return err;
 }
 
-static int sqlfs_release(const char *path, struct fuse_file_info *fi)
+static void sqlfs_flush(fuse_req_t req, fuse_ino_t ino,
+			struct fuse_file_info *fi)
 {
-  int err = 0;
-
-  if (g_hash_table_contains(cache.open_table, &(fi->fh)))
-    g_hash_table_remove(cache.open_table, &(fi->fh));
-
-  return err;
+  fuse_reply_err(req, flush_file(ino, fi));
 }
 
-static int sqlfs_unlink(const char *path)
+/*
+ * Сбросить изменения в БД сразу, не дожидаясь deploy_time
+ */
+static int sync_deploy()
 {
-  int err = 0;
   GError *terr = NULL;
-  remove_object(path, &terr);
+  flush_deploy(&terr);
+
   if (terr != NULL) {
-    if (terr->code == EENOTFOUND) {
-      err = -ENOENT;
-    }
-    else {
-      err = -EFAULT;
-    }
-  }
-  
-  if (terr != NULL)
     g_error_free(terr);
-  
-  return err;
+    return EIO;
+  }
+
+  return 0;
+}
+
+static void sqlfs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+			struct fuse_file_info *fi)
+{
+  int err = flush_file(ino, fi);
+
+  if (!err)
+    err = sync_deploy();
+
+  fuse_reply_err(req, err);
 }
 
+static void sqlfs_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync,
+			   struct fuse_file_info *fi)
+{
+  fuse_reply_err(req, sync_deploy());
+}
 
-static int sqlfs_truncate(const char *path, off_t offset)
+static void sqlfs_release(fuse_req_t req, fuse_ino_t ino,
+			  struct fuse_file_info *fi)
 {
-  int err = 0;
+  remove_file(fi->fh);
+
+  fuse_reply_err(req, 0);
+}
+
+static void sqlfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+  gchar *path = get_child_path(parent, name);
   GError *terr = NULL;
 
-  truncate_object(path, offset, &terr);
-  
+  if (path == NULL)
+    g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		"%d: Inode not found\n", __LINE__);
+  else
+    remove_object(path, &terr);
+
   if (terr != NULL) {
-    if (terr->code == EENOTFOUND) {
-      err = -ENOENT;
-    }
-    else {
-      err = -EFAULT;
-    }
-  }
-  
-  if (terr != NULL)
+    fuse_reply_err(req, (terr->code == EENOTFOUND) ? ENOENT : EFAULT);
     g_error_free(terr);
-  
-  return err;
-}
+  }
+  else {
+    unlink_inode(path);
+    fuse_reply_err(req, 0);
+  }
 
+  g_free(path);
+}
 
-static int sqlfs_rename(const char *oldname, const char *newname)
+static void sqlfs_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+			 fuse_ino_t newparent, const char *newname)
 {
   GError *terr = NULL;
-  int err = 0;
-  
-  rename_object(oldname, newname, &terr);
+  gchar *oldpath = get_child_path(parent, name);
+  gchar *newpath = get_child_path(newparent, newname);
+
+  if (oldpath == NULL || newpath == NULL)
+    g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		"%d: Inode not found\n", __LINE__);
+  else
+    rename_object(oldpath, newpath, &terr);
+
   if (terr != NULL) {
-    switch(terr->code) {
-    case EENOTFOUND:
-      err = -ENOENT;
-      break;
-    case EENOTSUP:
-      err = -ENOTSUP;
-      break;
-    default:
-      err = -EFAULT;
-    }
-  }
- 
-  if (terr != NULL)
+    fuse_reply_err(req, error2errno(terr));
     g_error_free(terr);
-  
-  return err;
+  }
+  else {
+    rename_inode(oldpath, newparent, newname, newpath);
+    fuse_reply_err(req, 0);
+  }
+
+  g_free(oldpath);
+  g_free(newpath);
 }
 
-static int sqlfs_listxattr(const char *path, char *list, size_t size)
+static void sqlfs_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
 {
-  int res = 0;
+  size_t res = 0;
+  gchar *path = get_inode_path(ino);
+  if (path == NULL) {
+    fuse_reply_err(req, ENOENT);
+    return ;
+  }
 
   GError *terr = NULL;
   GList *listx = fetch_listxattr(path, &terr);
-  
-  if (listx != NULL) {
-    listx = g_list_first(listx);
-    
-    while (listx) {
-      gchar *str = (gchar *) listx->data;
-
-      if (size >= res + strlen(str) + 1) {
-	memcpy(list + res, str, strlen(str) + 1);
-      }
+  GString *list = g_string_new(NULL);
 
-      res += strlen(str) + 1;
-      listx = g_list_next(listx);
-    }
-    
-    listx = g_list_first(listx);
-    g_list_free(listx);
+  GList *wrk = g_list_first(listx);
+  while (wrk) {
+    gchar *str = (gchar *) wrk->data;
+    g_string_append_len(list, str, strlen(str) + 1);
+    wrk = g_list_next(wrk);
   }
+  g_list_free(listx);
+
+  res = list->len;
+
+  if (size == 0)
+    fuse_reply_xattr(req, res);
+  else
+    if (size < res)
+      fuse_reply_err(req, ERANGE);
+    else
+      fuse_reply_buf(req, list->str, res);
+
+  g_string_free(list, TRUE);
+  g_free(path);
 
   if (terr != NULL)
     g_error_free(terr);
-
-  return res;
 }
 
-static int sqlfs_getxattr(const char *path, const char *name,
-			  char *value, size_t size)
+static void sqlfs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+			   size_t size)
 {
-  int res = 0;
-  GError *terr = NULL;
+  size_t res = 0;
+  gchar *path = get_inode_path(ino);
+  if (path == NULL) {
+    fuse_reply_err(req, ENOENT);
+    return ;
+  }
 
+  GError *terr = NULL;
   char *xattr = fetch_xattr(path, name, &terr);
-  if (terr == NULL && xattr != NULL) {
-    
-    if (size >= strlen(xattr)) {
-      memcpy(value, xattr, strlen(xattr));
-    }
-    
+  if (terr == NULL && xattr != NULL)
     res = strlen(xattr);
-  }
-  
+
+  if (size == 0)
+    fuse_reply_xattr(req, res);
+  else
+    if (size < res)
+      fuse_reply_err(req, ERANGE);
+    else
+      fuse_reply_buf(req, xattr, res);
+
+  g_free(xattr);
+  g_free(path);
+
   if (terr != NULL)
     g_error_free(terr);
-  
-  return res;
 }
 
-static void free_sqlfs_file(gpointer pointer)
+/*
+ * Согласовать с ядром крупные записи и асинхронное чтение: сохранение
+ * большого модуля проходит за несколько вызовов write вместо сотен
+ */
+static void sqlfs_init(void *userdata, struct fuse_conn_info *conn)
 {
-  sqlfs_file_t *fsfile = (sqlfs_file_t *) pointer;
-  if (fsfile) {
-    if (fsfile->buffer)
-      g_free(fsfile->buffer);
-    
-    g_free(fsfile); 
+  (void) userdata;
+
+#if FUSE_VERSION >= 28
+  if (conn->capable & FUSE_CAP_ASYNC_READ)
+    conn->want |= FUSE_CAP_ASYNC_READ;
+
+  if (conn->capable & FUSE_CAP_BIG_WRITES) {
+    conn->want |= FUSE_CAP_BIG_WRITES;
+    conn->max_write = MAX_WRITE;
   }
+#endif
 }
 
-static struct fuse_operations sqlfs_oper = {
+static struct fuse_lowlevel_ops sqlfs_oper = {
+  .init = sqlfs_init,
+  .lookup = sqlfs_lookup,
+  .forget = sqlfs_forget,
+#if FUSE_VERSION >= 29
+  .forget_multi = sqlfs_forget_multi,
+#endif
   .getattr = sqlfs_getattr,
+  .setattr = sqlfs_setattr,
+  .opendir = sqlfs_opendir,
   .readdir = sqlfs_readdir,
+  .releasedir = sqlfs_releasedir,
+  .fsyncdir = sqlfs_fsyncdir,
   .read = sqlfs_read,
   .open = sqlfs_open,
   .mkdir = sqlfs_mkdir,
   .mknod = sqlfs_mknod,
   .write = sqlfs_write,
   .rename = sqlfs_rename,
-  .utime = sqlfs_utime,
-  .chown = sqlfs_chown,
-  .chmod = sqlfs_chmod,
   .unlink = sqlfs_unlink,
   .rmdir = sqlfs_rmdir,
-  .truncate = sqlfs_truncate,
   .flush = sqlfs_flush,
+  .fsync = sqlfs_fsync,
   .release = sqlfs_release,
   .listxattr = sqlfs_listxattr,
   .getxattr = sqlfs_getxattr,
 };
 
-static int sqlfs_fuse_main(struct fuse_args *args)
+/*
+ * Смонтировать ФС и обслуживать запросы ядра. Кэш запускается после
+ * ухода в фон, иначе его потоки не переживут fork.
+ */
+static int sqlfs_fuse_main(struct fuse_args *args, GError **error)
 {
-#if FUSE_VERSION >= 26
-  return fuse_main(args->argc, args->argv, &sqlfs_oper, NULL);
-#else
-  return fuse_main(args->argc, args->argv, &sqlfs_oper);
-#endif
+  GError *terr = NULL;
+  char *mountpoint = NULL;
+  int multithreaded = 0, foreground = 0;
+  int err = -1;
+
+  if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1)
+    return err;
+
+  struct fuse_chan *ch = fuse_mount(mountpoint, args);
+  if (ch != NULL) {
+    struct fuse_session *se = fuse_lowlevel_new(args, &sqlfs_oper,
+						sizeof(sqlfs_oper), NULL);
+    if (se != NULL) {
+      if (fuse_set_signal_handlers(se) != -1) {
+	fuse_session_add_chan(se, ch);
+	fuse_daemonize(foreground);
+
+	init_cache(&terr);
+	if (terr == NULL) {
+	  err = (multithreaded) ? fuse_session_loop_mt(se)
+	    : fuse_session_loop(se);
+	  destroy_cache(&terr);
+	}
+
+	fuse_remove_signal_handlers(se);
+	fuse_session_remove_chan(ch);
+      }
+      fuse_session_destroy(se);
+    }
+    fuse_unmount(mountpoint, ch);
+  }
+
+  if (mountpoint != NULL)
+    free(mountpoint);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+
+  return err;
 }
 
 int main (int argc, char **argv)
@@ -529,8 +1423,28 @@ int main (int argc, char **argv)
   sqlprofile = g_try_new0(struct sqlprofile, 1);
   g_mutex_init(&cache.m);
   
-  cache.open_table = g_hash_table_new_full(g_int64_hash, g_int64_equal,
-					   g_free, free_sqlfs_file);
+  int i;
+  for (i = 0; i < OPEN_SHARDS; i++) {
+    g_mutex_init(&cache.open_shards[i].lock);
+    cache.open_shards[i].table = g_hash_table_new_full(g_int64_hash,
+						       g_int64_equal, NULL,
+						       free_sqlfs_file);
+  }
+  cache.ino_table = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					  NULL, free_sqlfs_inode);
+  cache.path_table = g_hash_table_new(g_str_hash, g_str_equal);
+  cache.attr_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, g_free);
+
+  // корень существует всегда и не забывается
+  struct sqlfs_inode *root = g_try_new0(struct sqlfs_inode, 1);
+  root->ino = cache.last_ino = FUSE_ROOT_ID;
+  root->name = g_strdup(G_DIR_SEPARATOR_S);
+  root->path = g_strdup(G_DIR_SEPARATOR_S);
+  root->nlookup = 1;
+  g_hash_table_insert(cache.ino_table, GSIZE_TO_POINTER(root->ino),
+		      root);
+  g_hash_table_insert(cache.path_table, root->path, root);
 
   if (fuse_opt_parse(&args, sqlprofile, sqlfs_opts, sqlfs_opt_proc) == -1)
     res = 1;
@@ -546,25 +1460,12 @@ int main (int argc, char **argv)
       res = 1;
     
     if (!res) {
-      init_cache(&terr);
-      
-      if (terr != NULL)
-	res = 2;
-    }
-
-    if (!res) {
-      res = sqlfs_fuse_main(&args);
+      if (sqlfs_fuse_main(&args, &terr) != 0)
+	res = (terr != NULL) ? 2 : 3;
       fuse_opt_free_args(&args);
 
-      if (terr != NULL)
-	res = 3;
-    }
-
-    if (!res || res > 2)
-      destroy_cache(&terr);
-
-    if (!res || res > 1)
       close_keyfile();
+    }
 
     if (sqlprofile != NULL) {
       if (sqlprofile->profile != NULL)
@@ -584,7 +1485,13 @@ int main (int argc, char **argv)
 	    res, 0, "Invalid arguments");
   }
 
-  g_hash_table_destroy(cache.open_table);
+  g_hash_table_destroy(cache.attr_table);
+  g_hash_table_destroy(cache.path_table);
+  g_hash_table_destroy(cache.ino_table);
+  for (i = 0; i < OPEN_SHARDS; i++) {
+    g_hash_table_destroy(cache.open_shards[i].table);
+    g_mutex_clear(&cache.open_shards[i].lock);
+  }
   
   g_mutex_clear(&cache.m);
   
@@ -21,6 +21,9 @@
 #include <string.h>
 #include "exec.h"
 
+// максимальный размер текстовых данных в ответе сервера
+#define MAX_TEXTSIZE "2147483647"
+
 typedef struct {
   GAsyncQueue *aqueue;
   gchar *to_codeset, *from_codeset;
@@ -199,6 +202,13 @@ static void reconnect(msctx_t *wrkctx, GError **error)
 		sqlctx->dbname);
   }
 
+  // тексты модулей читаются одной строкой без усечения
+  if (!terr && dbsetopt(wrkctx->dbproc, DBTEXTSIZE, MAX_TEXTSIZE, 0) == FAIL) {
+    g_set_error(&terr, EEXEC, EEXEC,
+		"%s:%d: unable sets text size\n",
+		sqlctx->appname, __LINE__);
+  }
+
   if (sqlctx->ansi_npw == TRUE && terr == NULL
       && !do_exec_sql(npw_sql, wrkctx, &terr)) {
     g_set_error(&terr, EEXEC, EEXEC,
@@ -268,6 +278,27 @@ void exec_sql_cmd(const char *sql, msctx_t *msctx, GError **error)
     g_propagate_error(error, terr);
 }
 
+void exec_sql_batch(const char *sql, msctx_t *msctx, GError **error)
+{
+  GError *terr = NULL;
+  RETCODE erc;
+
+  exec_sql_cmd(sql, msctx, &terr);
+
+  // результаты остальных команд пакета, ошибка любой из них - ошибка пакета
+  while (terr == NULL
+	 && (erc = dbresults(msctx->dbproc)) != NO_MORE_RESULTS) {
+    if (erc == FAIL)
+      g_set_error(&terr, EERES, EERES,
+		  "%d: dbresults() failed\n", __LINE__);
+    else
+      dbcanquery(msctx->dbproc);
+  }
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+}
+
 msctx_t * exec_sql(const char *sql, GError **error)
 {
   GError *terr = NULL;
@@ -42,7 +42,7 @@ void init_context(gpointer err_handler, gpointer msg_handler, GError **error);
  * Количество свободных подключений. 
  * Отрицательное значение, когда есть ожидающие процессы.
  */
-int get_free_count_contexts();
+int get_count_free_contexts();
 
 
 /*
@@ -57,6 +57,12 @@ msctx_t * get_msctx(GError **error);
 void exec_sql_cmd(const char *sql, msctx_t *msctx, GError **error);
 
 
+/*
+ * Выполнить пакет из нескольких SQL-команд, не возвращающих строк
+ */
+void exec_sql_batch(const char *sql, msctx_t *msctx, GError **error);
+
+
 /*
  * Выполнить SQL-запрос на основе контекста
  */
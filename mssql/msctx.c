@@ -388,36 +388,40 @@ char * remove_ms_object(const char *schema, const char *parent,
   return result;
 }
 
-static inline char * load_help_text(const char *parent, struct sqlfs_ms_obj *obj,
-				    GError **error)
+/*
+ * Текст модуля из sys.sql_modules, found - строка модуля найдена
+ */
+static char * query_definition(const char *sql, gboolean *found,
+			       GError **error)
 {
   GError *terr = NULL;
   char *def = NULL;
-  GString *sql = g_string_new(NULL);
-  
-  g_string_append_printf(sql, "EXEC sp_helptext '[%s].[%s]'", parent, obj->name);
-  msctx_t *ctx = exec_sql(sql->str, &terr);
+
+  *found = FALSE;
+  msctx_t *ctx = exec_sql(sql, &terr);
   if (!terr) {
-    g_string_truncate(sql, 0);
-    
-    DBCHAR def_buf[256];
-    dbbind(ctx->dbproc, 1, NTBSTRINGBIND, (DBINT) 0, (BYTE *) def_buf);
     int rowcode;
     sqlctx_t *sqlctx = fetch_context(FALSE, &terr);
-    gchar *convert = NULL;
     while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
       switch(rowcode) {
-      case REG_ROW:
+      case REG_ROW: {
+	// текст целиком в буфере строки, длина точная
+	const gchar *data = (const gchar *) dbdata(ctx->dbproc, 1);
+	gsize len = dbdatlen(ctx->dbproc, 1);
+
+	if (*found)
+	  break;
+
+	*found = TRUE;
+	if (data == NULL)
+	  break;
+
 	if (sqlctx->from_codeset != NULL && sqlctx->to_codeset != NULL)
-	  convert = g_convert(def_buf, strlen(def_buf),
-			      sqlctx->from_codeset, sqlctx->to_codeset,
-			      NULL, NULL, &terr);
+	  def = g_convert(data, len, sqlctx->from_codeset, sqlctx->to_codeset,
+			  NULL, NULL, &terr);
 	else
-	  convert = g_strdup(def_buf);
-	
-	g_string_append(sql, convert);
-	
-	g_free(convert);
+	  def = g_strndup(data, len);
+      }
 	break;
       case BUF_FULL:
 	g_set_error(&terr, EEFULL, EEFULL,
@@ -429,21 +433,49 @@ static inline char * load_help_text(const char *parent, struct sqlfs_ms_obj *obj
 	break;
       }
     }
-      
-    if (!terr) {
-      /* FIXME: #23 */
-      if (obj->len > strlen(sql->str)) {
-	char *nlspc = g_strnfill(obj->len - strlen(sql->str), ' ');
-	g_string_append_printf(sql, nlspc);
-	g_free(nlspc);
-      }
 
-      def = g_strdup(sql->str);
-    }
-    
+    // зашифрованный модуль: строка есть, текста нет
+    if (!terr && *found && def == NULL)
+      def = g_strdup("");
   }
   
   close_sql(ctx);
+
+  if (terr != NULL) {
+    g_free(def);
+    def = NULL;
+    g_propagate_error(error, terr);
+  }
+
+  return def;
+}
+
+static inline char * load_definition(const char *parent,
+				     struct sqlfs_ms_obj *obj, GError **error)
+{
+  GError *terr = NULL;
+  char *def = NULL;
+  gboolean found = FALSE;
+  GString *sql = g_string_new(NULL);
+  
+  if (obj->object_id > 0) {
+    g_string_printf(sql, "SELECT definition FROM sys.sql_modules "
+		    "WHERE object_id = %d", obj->object_id);
+    def = query_definition(sql->str, &found, &terr);
+  }
+
+  // id в кэше устарел: объект пересоздан или переименован другим сеансом
+  if (terr == NULL && !found) {
+    g_string_printf(sql, "SELECT definition FROM sys.sql_modules "
+		    "WHERE object_id = OBJECT_ID(N'[%s].[%s]')",
+		    parent, obj->name);
+    def = query_definition(sql->str, &found, &terr);
+  }
+
+  if (terr == NULL && !found)
+    g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		"%d: Object not found\n", __LINE__);
+
   g_string_free(sql, TRUE);
 
   if (terr != NULL)
@@ -469,7 +501,7 @@ char * load_module_text(const char *parent, struct sqlfs_ms_obj *obj,
     def = g_strdup(obj->def);
     break;
   default:
-    def = load_help_text(parent, obj, &terr);
+    def = load_definition(parent, obj, &terr);
     break;
   }
   
@@ -554,6 +586,16 @@ GList * fetch_table_obj(int schema_id, int table_id, const char *name,
   GError *terr = NULL;
   struct pt_task *task = NULL;
 
+  // все запросы уровня таблицы одним обращением к серверу
+  if (get_context()->batchfetch && table_id) {
+    reslist = fetch_table_batch(table_id, name, ctx, &terr);
+
+    if (terr != NULL)
+      g_propagate_error(error, terr);
+
+    return reslist;
+  }
+
   // отрицательное, когда есть ожидающие процессы
   int free_conn = get_count_free_contexts();
 
@@ -705,6 +747,142 @@ GList * fetch_xattr_list(int class_id, int major_id, int minor_id,
   return lst;
 }
 
+GList * fetch_changes(const char *mdate, msctx_t *ctx, GError **error)
+{
+  GString * sql = g_string_new(NULL);
+  GError *terr = NULL;
+
+  g_string_append(sql, "SELECT 1, s.name, s.schema_id, COUNT(o.object_id)");
+  g_string_append(sql, ", ISNULL(CONVERT(VARCHAR(23), MAX(o.modify_date), 121), '') ");
+  g_string_append(sql, "FROM sys.schemas s ");
+  g_string_append(sql, "LEFT JOIN sys.objects o ON o.schema_id = s.schema_id ");
+
+  gchar **excl = get_context()->excl_sch;
+  if (excl != NULL && g_strv_length(excl) > 0) {
+    gchar *excl_sch = g_strjoinv("','", excl);
+    g_string_append_printf(sql, "WHERE s.name NOT IN ('%s') ", excl_sch);
+    g_free(excl_sch);
+  }
+  
+  g_string_append(sql, "GROUP BY s.name, s.schema_id");
+
+  if (mdate != NULL && *mdate) {
+    g_string_append(sql, "\nUNION ALL\n");
+    g_string_append(sql, "SELECT 0, s.name");
+    g_string_append(sql, ", ISNULL(NULLIF(o.parent_object_id, 0), o.object_id), 0");
+    g_string_append(sql, ", CONVERT(VARCHAR(23), o.modify_date, 121) ");
+    g_string_append(sql, "FROM sys.objects o ");
+    g_string_append(sql, "INNER JOIN sys.schemas s ON s.schema_id = o.schema_id ");
+    g_string_append_printf(sql, "WHERE o.modify_date > CONVERT(DATETIME, '%s', 121)",
+			   mdate);
+  }
+
+  GList *lst = NULL;
+
+  exec_sql_cmd(sql->str, ctx, &terr);
+  
+  if (!terr && ctx) {
+    int rowcode;
+    DBINT stat_buf, objid_buf, count_buf;
+    char * schname_buf = g_malloc0_n(dbcollen(ctx->dbproc, 2) + 1, sizeof(char ));
+    char mdate_buf[24];
+    dbbind(ctx->dbproc, 1, INTBIND, (DBINT) 0, (BYTE *) &stat_buf);
+    dbbind(ctx->dbproc, 2, STRINGBIND, dbcollen(ctx->dbproc, 2) + 1,
+	   (BYTE *) schname_buf);
+    dbbind(ctx->dbproc, 3, INTBIND, (DBINT) 0, (BYTE *) &objid_buf);
+    dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &count_buf);
+    dbbind(ctx->dbproc, 5, STRINGBIND, (DBINT) sizeof(mdate_buf),
+	   (BYTE *) mdate_buf);
+
+    while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
+      switch(rowcode) {
+      case REG_ROW: {
+	struct sqlfs_ms_change *change = g_try_new0(struct sqlfs_ms_change, 1);
+	change->is_stat = stat_buf;
+	change->schema = g_strdup(g_strchomp(schname_buf));
+	change->object_id = objid_buf;
+	change->count = count_buf;
+	change->mdate = g_strdup(g_strchomp(mdate_buf));
+	
+	lst = g_list_append(lst, change);
+      }
+	break;
+      case BUF_FULL:
+	g_set_error(&terr, EEFULL, EEFULL,
+		    "%d: dbresults failed\n", __LINE__);
+	break;
+      case FAIL:
+	g_set_error(&terr, EERES, EERES,
+		    "%d: dbresults failed\n", __LINE__);
+	break;
+      }
+    }
+    
+    g_free(schname_buf);
+  }
+  
+  g_string_free(sql, TRUE);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+  
+  return lst;
+}
+
+void fetch_modify_dates(GHashTable *schemas, GHashTable *objects,
+			msctx_t *ctx, GError **error)
+{
+  GString * sql = g_string_new(NULL);
+  GError *terr = NULL;
+
+  g_string_append(sql, "SELECT 1, schema_id, name, 0 FROM sys.schemas\n");
+  g_string_append(sql, "UNION ALL\n");
+  g_string_append(sql, "SELECT 0, object_id, '', ");
+  g_string_append(sql, "DATEDIFF(second, {d '1970-01-01'}, modify_date) ");
+  g_string_append(sql, "FROM sys.objects WHERE parent_object_id = 0");
+
+  exec_sql_cmd(sql->str, ctx, &terr);
+  
+  if (!terr && ctx) {
+    int rowcode;
+    DBINT is_schema, id_buf, mdate_buf;
+    char * name_buf = g_malloc0_n(dbcollen(ctx->dbproc, 3) + 1, sizeof(char ));
+    dbbind(ctx->dbproc, 1, INTBIND, (DBINT) 0, (BYTE *) &is_schema);
+    dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &id_buf);
+    dbbind(ctx->dbproc, 3, STRINGBIND, dbcollen(ctx->dbproc, 3) + 1,
+	   (BYTE *) name_buf);
+    dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &mdate_buf);
+
+    while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
+      switch(rowcode) {
+      case REG_ROW:
+	if (is_schema)
+	  g_hash_table_insert(schemas, GINT_TO_POINTER(id_buf),
+			      g_strdup(g_strchomp(name_buf)));
+	else
+	  g_hash_table_insert(objects, GINT_TO_POINTER(id_buf),
+			      GINT_TO_POINTER(mdate_buf));
+	break;
+      case BUF_FULL:
+	g_set_error(&terr, EEFULL, EEFULL,
+		    "%d: dbresults failed\n", __LINE__);
+	break;
+      case FAIL:
+	g_set_error(&terr, EERES, EERES,
+		    "%d: dbresults failed\n", __LINE__);
+	break;
+      }
+    }
+    
+    g_free(name_buf);
+  }
+  
+  g_string_free(sql, TRUE);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+}
+
 GList * fetch_schema_obj(int schema_id, const char *name,
 			 msctx_t *ctx, GError **error)
 {
@@ -890,12 +1068,40 @@ GList * fetch_schemas(const char *name, msctx_t *ctx, int astart, GError **error
   return lst;
 }
 
+void free_ms_change(gpointer change)
+{
+  if (!change)
+    return ;
+
+  struct sqlfs_ms_change *obj = (struct sqlfs_ms_change *) change;
+
+  if (obj->schema != NULL)
+    g_free(obj->schema);
+
+  if (obj->mdate != NULL)
+    g_free(obj->mdate);
+
+  g_free(obj);
+}
+
+struct sqlfs_ms_obj * ref_ms_obj(struct sqlfs_ms_obj *obj)
+{
+  if (obj != NULL)
+    g_atomic_int_inc(&obj->refs);
+
+  return obj;
+}
+
 void free_ms_obj(gpointer msobj)
 {
   if (!msobj)
     return ;
   
   struct sqlfs_ms_obj *obj = (struct sqlfs_ms_obj *) msobj;
+
+  // объект ещё используется другими потоками
+  if (g_atomic_int_add(&obj->refs, -1) > 0)
+    return ;
   
   switch(obj->type) {
   case R_D:
@@ -170,6 +170,25 @@ struct sqlfs_ms_obj {
   
   time_t ctime;
   time_t mtime;
+
+  // ссылки потоков сверх владельца (слот кэша или список),
+  // объект освобождается последним free_ms_obj
+  volatile gint refs;
+};
+
+/*
+ * Изменение в схеме: статистика по схеме (is_stat) или объект уровня
+ * схемы, изменённый после отметки времени
+ */
+struct sqlfs_ms_change {
+  int is_stat;
+  char *schema;
+
+  int object_id;
+  int count;
+
+  // дата изменения в формате ODBC (стиль 121)
+  char *mdate;
 };
 
 
@@ -190,6 +209,18 @@ struct sqlfs_ms_obj * find_ms_object(struct sqlfs_ms_obj *parent,
 GList * fetch_schemas(const char *name, msctx_t *ctx, int astart,
 		      GError **error);
 
+/*
+ * Статистика по схемам и объекты, изменённые после mdate
+ */
+GList * fetch_changes(const char *mdate, msctx_t *ctx, GError **error);
+
+/*
+ * Имена схем (schema_id -> имя) и даты изменения объектов уровня схемы
+ * (object_id -> время)
+ */
+void fetch_modify_dates(GHashTable *schemas, GHashTable *objects,
+			msctx_t *ctx, GError **error);
+
 /*
  * Список объектов уровня схемы
  */
@@ -236,10 +267,20 @@ char * remove_ms_object(const char *schema, const char *parent,
 			struct sqlfs_ms_obj *obj, GError **error);
 
 /*
- * Убрать за объектом
+ * Взять ссылку на объект, вернуть её - free_ms_obj
+ */
+struct sqlfs_ms_obj * ref_ms_obj(struct sqlfs_ms_obj *obj);
+
+/*
+ * Убрать за объектом или вернуть ссылку на него
  */
 void free_ms_obj(gpointer msobj);
 
+/*
+ * Убрать за изменением
+ */
+void free_ms_change(gpointer change);
+
 
 /*
  * Закончить работу с контекстом
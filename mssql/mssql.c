@@ -22,22 +22,97 @@
 
 #include "msctx.h"
 #include "util.h"
+#include "tree.h"
+#include "snapshot.h"
 
 #include <string.h>
 
 struct sqlcache {
   GMutex m;
-  
-  GHashTable *db_table, *app_table, *mask_table;
+
+  // дерево объектов: слот NODE_DB - кэш БД, слот NODE_APP - кэш приложения
+  struct sqlfs_node *root;
+  GHashTable *mask_table;
+
+  // кэш отсутствующих объектов: путь -> struct neg_entry
+  GHashTable *neg_table;
+  GQueue *neg_queue;
+
+  // кэш текстов модулей: object_id -> struct text_entry
+  GHashTable *text_table;
+  GQueue *text_queue;
+  gsize text_size;
+
+  // счётчик условных id объектов, которых ещё нет в БД
+  volatile gint mask_seq;
+};
+
+struct text_entry {
+  int object_id;
+  time_t mtime;
+
+  gchar *text;
+  gsize len;
+
+  // ссылка в очереди вытеснения text_queue
+  GList *link;
+};
+
+struct neg_entry {
+  gint64 expire;
+
+  // ссылка в очереди вытеснения neg_queue
+  GList *link;
 };
 
 struct sqldeploy {
-  GCond cond;
+  GCond cond, done_cond;
   GMutex lock;
-  GTimer *timer;
   volatile int run;
   GThread *thread;
   GSequence *sql_seq;
+
+  // монотонное время первой и последней правки в очереди, 0 - очередь пуста
+  gint64 first, last;
+
+  // номера забранной и выполненной очередей и номер последней очереди,
+  // сброс которой завершился ошибкой (0 - нет)
+  guint64 taken, done, failed;
+
+  // запрос немедленного сброса
+  gboolean flush;
+
+  // индексы очереди: путь и директория команды -> GQueue из
+  // GSequenceIter в порядке очереди
+  GHashTable *path_index;
+  GHashTable *dir_index;
+};
+
+struct sqlwatch {
+  GCond cond;
+  GMutex lock;
+  volatile int run;
+  GThread *thread;
+
+  // статистика схем: имя -> struct sch_stat
+  GHashTable *stat_table;
+
+  // отметка времени последнего известного изменения
+  gchar *mdate;
+};
+
+struct sqlhotstart {
+  volatile int run;
+  GThread *thread;
+
+  // пути, изменённые во время загрузки схемы, под cache.m
+  gboolean loading;
+  GHashTable *changed;
+};
+
+struct sch_stat {
+  int count;
+  gchar *mdate;
 };
 
 enum action {
@@ -59,16 +134,13 @@ struct sqlcmd {
 
 #define SAFE_REMOVE_ALL(p)						\
   g_mutex_lock(&cache.m);						\
-  if (g_hash_table_contains(cache.db_table, p))				\
-    g_hash_table_remove(cache.db_table, p);				\
-  if (g_hash_table_contains(cache.app_table, p))			\
-    g_hash_table_remove(cache.app_table, p);				\
+  remove_tree(cache.root, p, NODE_DB);					\
+  remove_tree(cache.root, p, NODE_APP);					\
   g_mutex_unlock(&cache.m);
 
 
 #define CLEAR_DEPLOY()							\
-  g_sequence_remove_range(g_sequence_get_begin_iter(deploy.sql_seq),	\
-			  g_sequence_get_end_iter(deploy.sql_seq));	\
+  clear_queue();							\
   g_hash_table_remove_all(cache.mask_table);
 
 #define IS_DIR(object) object->type < 0x08
@@ -77,12 +149,18 @@ struct sqlcmd {
 #define IS_SCHOBJ(object) (object->type >= R_FN && object->type <= R_P	\
 			   || object->type == R_FT || object->type == R_TF \
 			   || object->type == R_IF)
+#define IS_MODCMD(cmd) (cmd->mstype >= R_FN && cmd->mstype <= R_P	\
+			|| cmd->mstype == R_FT || cmd->mstype == R_TF	\
+			|| cmd->mstype == R_IF || cmd->mstype == R_TR	\
+			|| cmd->mstype == D_V || cmd->mstype == D_SCHEMA)
 #define IS_TBLCMD(cmd) (cmd->mstype == R_C || cmd->mstype == R_D	\
 			|| cmd->mstype == R_PK || cmd->mstype == R_UQ	\
 			|| cmd->mstype == R_X || cmd->mstype == R_F)
 
 static struct sqlcache cache;
 static struct sqldeploy deploy;
+static struct sqlwatch watch;
+static struct sqlhotstart hot;
 
 #define CMD_DISABLED 0x0
 #define CMD_IDENTITY 0x1
@@ -149,26 +227,306 @@ static int get_mask_id(const char *path)
   }
   else {
     
-    struct sqlfs_ms_obj *obj = g_hash_table_lookup(cache.db_table, path);
-    if (obj) {
-      obj_id = obj->object_id;
+    g_mutex_lock(&cache.m);
+    struct sqlfs_node *node = find_node(cache.root, path);
+    if (node && node->obj[NODE_DB]) {
+      obj_id = node->obj[NODE_DB]->object_id;
       res = TRUE;
     }
     else {
-      obj = g_hash_table_lookup(cache.app_table, path);
-      if (obj) {
-	obj_id = obj->object_id;
+      if (node && node->obj[NODE_APP]) {
+	obj_id = node->obj[NODE_APP]->object_id;
       }
     }
+    g_mutex_unlock(&cache.m);
     
   }
 
+  // объект есть, но его id неизвестен: условный отрицательный id
+  // не пересекается с sys.objects
   if (res && !obj_id)
-    obj_id = g_get_monotonic_time();
+    obj_id = -1 - g_atomic_int_add(&cache.mask_seq, 1);
 
   return obj_id;
 }
 
+/*
+ * Номер inode из (тип, major_id, minor_id): 8 бит типа, 32 бита id объекта
+ * и 24 бита id колонки или индекса. 0 - объекта ещё нет в БД.
+ */
+static guint64 make_ino(struct sqlfs_ms_obj *obj)
+{
+  int major_id = obj->object_id, minor_id = 0;
+
+  switch (obj->type) {
+  case R_COL:
+    major_id = obj->parent_id;
+    minor_id = (obj->column && obj->column->column_id > 0)
+      ? obj->column->column_id : -1;
+    break;
+  case R_PK:
+  case R_UQ:
+  case R_X:
+    // index_id уникален только в пределах таблицы
+    major_id = obj->parent_id;
+    minor_id = (obj->object_id > 0) ? obj->object_id : -1;
+    break;
+  }
+
+  if (major_id <= 0 || minor_id < 0 || minor_id > 0xFFFFFF)
+    return 0;
+
+  return ((guint64) (obj->type & 0xFF) << 56)
+    | ((guint64) (guint32) major_id << 24)
+    | (guint64) minor_id;
+}
+
+/*
+ * Время жизни объекта в DB-кэше в секундах, 0 - до перечитывания директории
+ */
+static int get_ttl(unsigned int type)
+{
+  sqlctx_t *sqlctx = get_context();
+
+  switch (type) {
+  case D_SCHEMA:
+    return sqlctx->schttl;
+  case D_IT:
+  case D_S:
+  case D_TT:
+  case D_U:
+  case D_V:
+    return sqlctx->tblttl;
+  case R_COL:
+  case R_C:
+  case R_D:
+  case R_PK:
+  case R_UQ:
+  case R_F:
+  case R_X:
+    return sqlctx->colttl;
+  default:
+    if (type >= R_AF && type < R_COL)
+      return sqlctx->modttl;
+  }
+
+  return 0;
+}
+
+static inline gboolean is_fresh(struct sqlfs_node *node)
+{
+  struct sqlfs_ms_obj *obj = (node) ? node->obj[NODE_DB] : NULL;
+  if (!obj)
+    return FALSE;
+
+  int ttl = get_ttl(obj->type);
+  if (ttl <= 0)
+    return TRUE;
+
+  return (g_get_monotonic_time() - node->cached < ttl * G_USEC_PER_SEC);
+}
+
+/*
+ * Содержимое директории выбрано из БД и ещё не устарело
+ */
+static gboolean is_listed(struct sqlfs_node *dir)
+{
+  if (!dir || !dir->listed)
+    return FALSE;
+
+  int ttl = 0;
+  if (dir == cache.root)
+    ttl = get_ttl(D_SCHEMA);
+  else
+    if (dir->obj[NODE_DB] && dir->obj[NODE_DB]->type == D_SCHEMA)
+      ttl = get_ttl(D_U);
+    else
+      ttl = get_ttl(R_COL);
+
+  if (ttl <= 0)
+    return FALSE;
+
+  return (g_get_monotonic_time() - dir->listed < ttl * G_USEC_PER_SEC);
+}
+
+static gboolean is_negative(const char *path)
+{
+  gboolean result = FALSE;
+  if (get_context()->negttl <= 0)
+    return result;
+
+  g_mutex_lock(&cache.m);
+  struct neg_entry *entry = g_hash_table_lookup(cache.neg_table, path);
+  if (entry != NULL) {
+    if (entry->expire > g_get_monotonic_time()) {
+      result = TRUE;
+    }
+    else {
+      g_queue_delete_link(cache.neg_queue, entry->link);
+      g_hash_table_remove(cache.neg_table, path);
+    }
+  }
+  g_mutex_unlock(&cache.m);
+
+  return result;
+}
+
+static void add_negative(const char *path)
+{
+  sqlctx_t *sqlctx = get_context();
+  if (sqlctx->negttl <= 0)
+    return ;
+
+  g_mutex_lock(&cache.m);
+  struct neg_entry *entry = g_hash_table_lookup(cache.neg_table, path);
+  if (entry == NULL) {
+
+    // вытеснить самую старую запись
+    if (g_hash_table_size(cache.neg_table) >= sqlctx->negsize) {
+      gchar *old = g_queue_pop_head(cache.neg_queue);
+      g_hash_table_remove(cache.neg_table, old);
+    }
+
+    entry = g_try_new0(struct neg_entry, 1);
+    gchar *key = g_strdup(path);
+    g_queue_push_tail(cache.neg_queue, key);
+    entry->link = g_queue_peek_tail_link(cache.neg_queue);
+    g_hash_table_insert(cache.neg_table, key, entry);
+  }
+
+  entry->expire = g_get_monotonic_time() + sqlctx->negttl * G_USEC_PER_SEC;
+  g_mutex_unlock(&cache.m);
+}
+
+/*
+ * Забыть отсутствие объекта и всех объектов внутри него
+ */
+static void drop_negative(const char *path)
+{
+  if (get_context()->negttl <= 0)
+    return ;
+
+  g_mutex_lock(&cache.m);
+  if (g_hash_table_size(cache.neg_table) > 0) {
+    gchar *dir = g_strconcat(path, G_DIR_SEPARATOR_S, NULL);
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cache.neg_table);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      if (!g_strcmp0(key, path) || g_str_has_prefix(key, dir)) {
+	struct neg_entry *entry = (struct neg_entry *) value;
+	g_queue_delete_link(cache.neg_queue, entry->link);
+	g_hash_table_iter_remove(&iter);
+      }
+    }
+    g_free(dir);
+  }
+  g_mutex_unlock(&cache.m);
+}
+
+static void free_text_entry(gpointer data)
+{
+  struct text_entry *entry = (struct text_entry *) data;
+
+  if (entry->text != NULL)
+    g_free(entry->text);
+
+  g_free(entry);
+}
+
+/*
+ * Без module_ttl и poll_time дата изменения объекта в кэше никогда
+ * не обновляется, и кэш текстов отдавал бы устаревший текст
+ */
+static inline gsize get_text_budget()
+{
+  sqlctx_t *sqlctx = get_context();
+  if (sqlctx->modttl <= 0 && sqlctx->polltime <= 0)
+    return 0;
+
+  return (gsize) sqlctx->textcache * 1024 * 1024;
+}
+
+static void remove_text(struct text_entry *entry)
+{
+  cache.text_size -= entry->len;
+  g_queue_delete_link(cache.text_queue, entry->link);
+  g_hash_table_remove(cache.text_table, GINT_TO_POINTER(entry->object_id));
+}
+
+/*
+ * Вернёт копию текста модуля, если модуль не изменялся
+ */
+static gchar * get_text(struct sqlfs_ms_obj *obj)
+{
+  gchar *text = NULL;
+  if (!get_text_budget() || obj->object_id <= 0)
+    return text;
+
+  g_mutex_lock(&cache.m);
+  struct text_entry *entry = g_hash_table_lookup(cache.text_table,
+						 GINT_TO_POINTER(obj->object_id));
+  if (entry != NULL) {
+    if (entry->mtime == obj->mtime) {
+      text = g_strndup(entry->text, entry->len);
+
+      // недавно использованные - в конец очереди
+      g_queue_unlink(cache.text_queue, entry->link);
+      g_queue_push_tail_link(cache.text_queue, entry->link);
+    }
+    else
+      remove_text(entry);
+  }
+  g_mutex_unlock(&cache.m);
+
+  return text;
+}
+
+static void put_text(struct sqlfs_ms_obj *obj, const gchar *text)
+{
+  gsize budget = get_text_budget();
+  gsize len = strlen(text);
+  if (!budget || obj->object_id <= 0 || len > budget)
+    return ;
+
+  g_mutex_lock(&cache.m);
+  struct text_entry *entry = g_hash_table_lookup(cache.text_table,
+						 GINT_TO_POINTER(obj->object_id));
+  if (entry != NULL)
+    remove_text(entry);
+
+  // вытеснить давно не использованные тексты
+  while (cache.text_size + len > budget) {
+    entry = g_queue_peek_head(cache.text_queue);
+    remove_text(entry);
+  }
+
+  entry = g_try_new0(struct text_entry, 1);
+  entry->object_id = obj->object_id;
+  entry->mtime = obj->mtime;
+  entry->text = g_strndup(text, len);
+  entry->len = len;
+
+  g_queue_push_tail(cache.text_queue, entry);
+  entry->link = g_queue_peek_tail_link(cache.text_queue);
+  g_hash_table_insert(cache.text_table, GINT_TO_POINTER(entry->object_id), entry);
+  cache.text_size += len;
+  g_mutex_unlock(&cache.m);
+}
+
+static void drop_text(int object_id)
+{
+  if (!get_text_budget())
+    return ;
+
+  g_mutex_lock(&cache.m);
+  struct text_entry *entry = g_hash_table_lookup(cache.text_table,
+						 GINT_TO_POINTER(object_id));
+  if (entry != NULL)
+    remove_text(entry);
+  g_mutex_unlock(&cache.m);
+}
+
 static void do_mask(const char *path, struct sqlcmd *cmd)
 {
   if (g_hash_table_contains(cache.mask_table, path))
@@ -177,84 +535,120 @@ static void do_mask(const char *path, struct sqlcmd *cmd)
   g_hash_table_insert(cache.mask_table, g_strdup(path), cmd);
 }
 
+/*
+ * Найти объект, выбирая из БД недостающие и устаревшие компоненты пути.
+ * Вернёт ссылку на объект (free_ms_obj). Узлы дерева могут быть удалены
+ * опросом изменений, поэтому каждый шаг ищет узел от корня под cache.m,
+ * а устаревший объект заменяется в слоте, не освобождаясь у читателей.
+ */
 static struct sqlfs_ms_obj * do_find(const char *pathname, GError **error)
 {
   GError *terr = NULL;
-  GList *list = NULL;
 
-  unsigned int i = 0;
   const char *pn = g_path_skip_root(pathname);
-  char **tree = NULL;
-  if (pn == NULL || strlen(pn) < 2) {
-    pn = pathname;
-    tree = g_malloc0_n(2, sizeof(char *));
-    *tree = g_strdup(pn);
+  if (pn == NULL) {
+    g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		"%d: Object not found\n", __LINE__);
+    g_propagate_error(error, terr);
+    return NULL;
   }
-  else {
-    tree = g_strsplit(pn, G_DIR_SEPARATOR_S, -1);
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_ms_obj *obj = ref_ms_obj(cache.root->obj[NODE_DB]);
+  g_mutex_unlock(&cache.m);
+
+  // информация по базе данных
+  if (!*pn && !obj) {
+    obj = find_ms_object(NULL, G_DIR_SEPARATOR_S, &terr);
+    if (terr == NULL && obj) {
+      g_mutex_lock(&cache.m);
+      set_node_obj(cache.root, NODE_DB, ref_ms_obj(obj));
+      g_mutex_unlock(&cache.m);
+    }
   }
-  
-  GString *path = g_string_new(NULL);
-  
-  while(*tree && !terr) {
-    g_string_append_printf(path, "%s%s", G_DIR_SEPARATOR_S, *tree);
-  
-    struct sqlfs_ms_obj *obj = g_hash_table_lookup(cache.db_table, path->str);
-    
-    if (!obj) {
-      if (i == 0) {
-	obj = find_ms_object(NULL, *tree, &terr);
-      }
-      if (i > 0) {
-	obj = find_ms_object(g_list_last(list)->data, *tree, &terr);
-      }
+
+  // у схем родителя нет
+  if (*pn) {
+    free_ms_obj(obj);
+    obj = NULL;
+  }
+
+  gchar *prefix = g_alloca(strlen(pathname) + 1);
+  gsize plen = 0;
+  struct sqlfs_ms_obj *parent = NULL;
+
+  while (*pn && !terr) {
+    const char *sep = strchr(pn, G_DIR_SEPARATOR);
+    gsize len = (sep) ? (gsize) (sep - pn) : strlen(pn);
+
+    if (len > 0) {
+      prefix[plen++] = G_DIR_SEPARATOR;
+      memcpy(prefix + plen, pn, len);
+      plen += len;
+      prefix[plen] = '\0';
     }
-    
-    if (!terr) {
-      
-      if (obj && obj->name) {
-	list = g_list_append(list, obj);
-	if (!g_hash_table_contains(cache.db_table, path->str)) {
-	  g_mutex_lock(&cache.m);
-	  g_hash_table_insert(cache.db_table, g_strdup(path->str), obj);
-	  g_mutex_unlock(&cache.m);
+
+    const gchar *name = prefix + plen - len;
+    pn += len;
+    if (*pn)
+      pn++;
+
+    if (!len)
+      continue;
+
+    // объект предыдущего шага - родитель текущего
+    free_ms_obj(parent);
+    parent = obj;
+
+    g_mutex_lock(&cache.m);
+    struct sqlfs_node *child = find_node(cache.root, prefix);
+    obj = (is_fresh(child)) ? ref_ms_obj(child->obj[NODE_DB]) : NULL;
+    g_mutex_unlock(&cache.m);
+
+    if (!obj) {
+      obj = find_ms_object(parent, name, &terr);
+
+      if (!terr && obj && obj->name) {
+	g_mutex_lock(&cache.m);
+	child = make_node(cache.root, prefix);
+
+	// устаревший объект заменяется, свежий из другого потока остаётся
+	if (!is_fresh(child))
+	  set_node_obj(child, NODE_DB, ref_ms_obj(obj));
+	else {
+	  free_ms_obj(obj);
+	  obj = ref_ms_obj(child->obj[NODE_DB]);
 	}
+	g_mutex_unlock(&cache.m);
       }
-      else {
-	g_set_error(&terr, EENOTFOUND, EENOTFOUND,
-		    "%d: Object not found\n", __LINE__);
-	break;
-      }
-      
-    } else {
+    }
+
+    if (terr != NULL) {
       g_clear_error(&terr);
       g_set_error(&terr, EERES, EERES,
 		  "%d: Find object failed\n", __LINE__);
-      break;
     }
-    
-    tree++;
-    i++;
+    else
+      if (!obj || !obj->name)
+	g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		    "%d: Object not found\n", __LINE__);
   }
 
-  struct sqlfs_ms_obj *result = NULL;
-  
-  GList *last = g_list_last(list);
-  if (last && terr == NULL)
-    result = last->data;
-  
-  g_list_free(list);
-  
-  tree -= i;
-  g_strfreev(tree);
-  g_string_free(path, TRUE);
-  
-  if (terr != NULL)
+  free_ms_obj(parent);
+
+  if (terr != NULL) {
     g_propagate_error(error, terr);
+    free_ms_obj(obj);
+    obj = NULL;
+  }
 
-  return result;
+  return obj;
 }
 
+/*
+ * Объект из кэша приложения или БД, при необходимости выбирается из БД.
+ * Вернёт ссылку на объект, освобождается free_ms_obj.
+ */
 static struct sqlfs_ms_obj * find_cache_obj(const char *pathname, GError **error)
 {
   if (!g_path_is_absolute(pathname))
@@ -267,16 +661,17 @@ static struct sqlfs_ms_obj * find_cache_obj(const char *pathname, GError **error
     g_set_error(&terr, EENOTFOUND, EENOTFOUND,
 		"%d: Object not found\n", __LINE__);
   }
-  
-  struct sqlfs_ms_obj *obj = g_hash_table_lookup(cache.app_table, pathname);
-  if (terr == NULL) {
-    if (!obj)
-      obj = g_hash_table_lookup(cache.db_table, pathname);
-    
-    if (!obj) {
-      obj = do_find(pathname, &terr);
-    }
-  }
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_node *node = find_node(cache.root, pathname);
+  struct sqlfs_ms_obj *obj = (node) ? node->obj[NODE_APP] : NULL;
+  if (!obj && terr == NULL && is_fresh(node))
+    obj = node->obj[NODE_DB];
+  ref_ms_obj(obj);
+  g_mutex_unlock(&cache.m);
+
+  if (!obj && terr == NULL)
+    obj = do_find(pathname, &terr);
 
   if (terr != NULL)
     g_propagate_error(error, terr);
@@ -305,10 +700,50 @@ static inline struct sqlfs_object * ms2sqlfs(struct sqlfs_ms_obj *src)
   result->ctime = src->ctime;
   result->mtime = src->mtime;
   result->cached_time = g_get_monotonic_time();
+  result->ttl = get_ttl(src->type);
+  result->ino = make_ino(src);
   
   return result;
 }
 
+/*
+ * Копия объекта для другого потока: текст определения меняется
+ * под cache.m, поэтому и копируется под ним
+ */
+static struct sqlfs_object * copy_object(struct sqlfs_ms_obj *src)
+{
+  g_mutex_lock(&cache.m);
+  struct sqlfs_object *result = ms2sqlfs(src);
+  g_mutex_unlock(&cache.m);
+
+  return result;
+}
+
+/*
+ * Заменить текст определения объекта кэша, прежний текст освобождается.
+ * Объект доступен другим потокам, поэтому замена идёт под cache.m.
+ */
+static void set_def(struct sqlfs_ms_obj *obj, gchar *def)
+{
+  g_mutex_lock(&cache.m);
+  gchar *old = obj->def;
+  obj->def = def;
+  obj->len = (def) ? strlen(def) : 0;
+  g_mutex_unlock(&cache.m);
+
+  g_free(old);
+}
+
+/*
+ * Заменить id объекта кэша под cache.m, как и текст в set_def
+ */
+static void set_object_id(struct sqlfs_ms_obj *obj, int object_id)
+{
+  g_mutex_lock(&cache.m);
+  obj->object_id = object_id;
+  g_mutex_unlock(&cache.m);
+}
+
 static void free_sqlcmd_object(gpointer object)
 {
   if (object == NULL)
@@ -349,84 +784,203 @@ static inline void lock_cache() {
 }
 
 static inline void end_cache() {
-  g_timer_start(deploy.timer);
+  // каждая правка сдвигает срок сброса
+  if (g_sequence_get_length(deploy.sql_seq) > 0) {
+    deploy.last = g_get_monotonic_time();
+    if (!deploy.first)
+      deploy.first = deploy.last;
+  }
+  else
+    deploy.first = deploy.last = 0;
   
   g_cond_signal(&deploy.cond);
   g_mutex_unlock(&deploy.lock);
 }
 
-static inline gboolean pause_timer()
+static inline gboolean pause_deploy()
 {
-  if (g_mutex_trylock(&deploy.lock)) {
-    g_timer_stop(deploy.timer);
-    return TRUE;
-  }
-
-  return FALSE;
+  return g_mutex_trylock(&deploy.lock);
 }
 
-static inline void continue_timer(gboolean locked) {
-  if (locked) {
-    g_timer_continue(deploy.timer);
+static inline void continue_deploy(gboolean locked) {
+  if (locked)
     g_mutex_unlock(&deploy.lock);
-  }
 }
 
-static void insert2cache_sorted(struct sqlcmd *cmd)
+static gint compare_iter_desc(gconstpointer a, gconstpointer b)
 {
-  if (cmd->mstype == R_COL || IS_TBLCMD(cmd)) {
+  return g_sequence_iter_compare(*((GSequenceIter **) b),
+				 *((GSequenceIter **) a));
+}
 
-    gchar *cc = g_path_get_dirname(cmd->path);
-    GSequenceIter *mark = NULL;
-    GSequenceIter *iter = g_sequence_get_end_iter(deploy.sql_seq);
-    while(!g_sequence_iter_is_begin(iter)) {
-      iter = g_sequence_iter_prev(iter);
-      struct sqlcmd *pcmd = g_sequence_get(iter);
-      gchar *pc = g_path_get_dirname(pcmd->path);
+static void index_cmd(GHashTable *index, const char *key, GSequenceIter *iter)
+{
+  GQueue *queue = g_hash_table_lookup(index, key);
+  if (queue == NULL) {
+    queue = g_queue_new();
+    g_hash_table_insert(index, g_strdup(key), queue);
+  }
 
-      // смотреть дальше создания таблицы нет смысла
-      if ((pcmd->mstype == D_U && pcmd->act == CREP || pcmd->act == RENAME)
-	  && !g_strcmp0(pc, cmd->path)) {
-	g_free(pc);
-	break;
-      }
-    
-      // только в одном каталоге
-      if (!g_strcmp0(pc, cc)) {
-	
-	if (IS_TBLCMD(pcmd) && cmd->mstype == R_COL && cmd->act == CREP) {
-	  mark = iter;
-	}
+  // команда чаще всего встаёт в конец
+  GList *link = queue->tail;
+  while (link != NULL && g_sequence_iter_compare(link->data, iter) > 0)
+    link = link->prev;
 
-	if (IS_TBLCMD(cmd) && pcmd->mstype == R_COL && cmd->act == DROP) {
-	  mark = iter;
-	}
+  if (link == NULL)
+    g_queue_push_head(queue, iter);
+  else
+    g_queue_insert_after(queue, link, iter);
+}
 
-	// не смотреть дальше других операций
-	if (mark != NULL && pcmd->act != cmd->act) {
-	  g_free(pc);
-	  break;
-	}
+static void unindex_cmd(GHashTable *index, const char *key,
+			GSequenceIter *iter)
+{
+  GQueue *queue = g_hash_table_lookup(index, key);
+  if (queue == NULL)
+    return ;
+
+  g_queue_remove(queue, iter);
+  if (g_queue_is_empty(queue))
+    g_hash_table_remove(index, key);
+}
+
+/*
+ * Поставить команду в очередь перед before (NULL - в конец)
+ */
+static void queue_cmd(GSequenceIter *before, struct sqlcmd *cmd)
+{
+  GSequenceIter *iter = (before) ? g_sequence_insert_before(before, cmd)
+    : g_sequence_append(deploy.sql_seq, cmd);
+
+  gchar *dir = g_path_get_dirname(cmd->path);
+  index_cmd(deploy.path_index, cmd->path, iter);
+  index_cmd(deploy.dir_index, dir, iter);
+  g_free(dir);
+}
+
+static void unqueue_cmd(GSequenceIter *iter)
+{
+  struct sqlcmd *cmd = g_sequence_get(iter);
+
+  gchar *dir = g_path_get_dirname(cmd->path);
+  unindex_cmd(deploy.path_index, cmd->path, iter);
+  unindex_cmd(deploy.dir_index, dir, iter);
+  g_free(dir);
+
+  g_sequence_remove(iter);
+}
+
+static void clear_queue()
+{
+  g_hash_table_remove_all(deploy.path_index);
+  g_hash_table_remove_all(deploy.dir_index);
+
+  g_sequence_remove_range(g_sequence_get_begin_iter(deploy.sql_seq),
+			  g_sequence_get_end_iter(deploy.sql_seq));
+}
+
+static void append_index(GPtrArray *iters, GHashTable *index, const char *key)
+{
+  GQueue *queue = g_hash_table_lookup(index, key);
+  if (queue == NULL)
+    return ;
+
+  GList *link;
+  for (link = queue->head; link != NULL; link = link->next)
+    g_ptr_array_add(iters, link->data);
+}
+
+/*
+ * Команды над вложенными в директорию объектами на любую глубину.
+ * Просматриваются все директории индекса с префиксом dir: у промежуточной
+ * директории (таблица, у которой правились только колонки) может не быть
+ * своей команды.
+ */
+static void append_subtree(GPtrArray *iters, const char *dir)
+{
+  gsize len = strlen(dir);
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init(&iter, deploy.dir_index);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    const gchar *kdir = (const gchar *) key;
+
+    if (strncmp(kdir, dir, len)
+	|| (kdir[len] != '\0' && kdir[len] != G_DIR_SEPARATOR))
+      continue;
+
+    GList *link;
+    for (link = ((GQueue *) value)->head; link != NULL; link = link->next)
+      g_ptr_array_add(iters, link->data);
+  }
+}
+
+/*
+ * Команды, влияющие на создание/изменение объекта, от последней к первой:
+ * над тем же путём, создание родительской таблицы для колонки
+ * и над вложенными объектами директории
+ */
+static GPtrArray * collect_cmds(struct sqlcmd *cmd, struct sqlfs_ms_obj *obj)
+{
+  GPtrArray *iters = g_ptr_array_new();
+
+  append_index(iters, deploy.path_index, cmd->path);
+
+  if (cmd->mstype == R_COL) {
+    gchar *table = g_path_get_dirname(cmd->path);
+    append_index(iters, deploy.path_index, table);
+    g_free(table);
+  }
+
+  if (IS_DIR(obj))
+    append_index(iters, deploy.dir_index, cmd->path);
+
+  g_ptr_array_sort(iters, compare_iter_desc);
+
+  return iters;
+}
+
+static void insert2cache_sorted(struct sqlcmd *cmd)
+{
+  if (cmd->mstype == R_COL || IS_TBLCMD(cmd)) {
+
+    // просматриваются только команды того же каталога
+    gchar *cc = g_path_get_dirname(cmd->path);
+    GQueue *queue = g_hash_table_lookup(deploy.dir_index, cc);
+    GSequenceIter *mark = NULL, *next = NULL;
+    GList *link = (queue) ? queue->tail : NULL;
+
+    while (link != NULL) {
+      GSequenceIter *iter = link->data;
+      struct sqlcmd *pcmd = g_sequence_get(iter);
+
+      // другая последовательность
+      if (mark != NULL && g_sequence_iter_next(iter) != next)
+	break;
+
+      if (IS_TBLCMD(pcmd) && cmd->mstype == R_COL && cmd->act == CREP) {
+	mark = iter;
       }
-      else
-	// другая последовательность
-	if (mark != NULL) {
-	  g_free(pc);
-	  break;
-	}
-      
-      g_free(pc);
+
+      if (IS_TBLCMD(cmd) && pcmd->mstype == R_COL && cmd->act == DROP) {
+	mark = iter;
+      }
+
+      // не смотреть дальше других операций
+      if (mark != NULL && pcmd->act != cmd->act)
+	break;
+
+      next = iter;
+      link = link->prev;
     }
 
-    if (mark == NULL)
-      g_sequence_append(deploy.sql_seq, cmd);
-    else
-      g_sequence_insert_before(mark, cmd);
+    queue_cmd(mark, cmd);
     
     g_free(cc);
   }
   else
-    g_sequence_append(deploy.sql_seq, cmd);
+    queue_cmd(NULL, cmd);
 }
 
 static void crep_object(const char *path, struct sqlcmd *cmd,
@@ -446,9 +1000,10 @@ static void crep_object(const char *path, struct sqlcmd *cmd,
   gboolean stop = TRUE;
   GString *sql = g_string_new(NULL);
   gchar **schema = g_strsplit(g_path_skip_root(path), G_DIR_SEPARATOR_S, -1);
-  GSequenceIter *iter = g_sequence_get_end_iter(deploy.sql_seq);
-  while(!g_sequence_iter_is_begin(iter)) {
-    iter = g_sequence_iter_prev(iter);
+  GPtrArray *iters = collect_cmds(cmd, obj);
+  guint i = 0;
+  while (i < iters->len) {
+    GSequenceIter *iter = g_ptr_array_index(iters, i++);
     struct sqlcmd *pcmd = g_sequence_get(iter);
 
     // операция была выключена при рекурсивном удалении директории
@@ -517,20 +1072,20 @@ static void crep_object(const char *path, struct sqlcmd *cmd,
       // или произошло переименование, - использовать CREATE
       if (pcmd->mstype != obj->type && obj->type != R_TEMP && pcmd->act == DROP
 	  || pcmd->act == RENAME) {
-	obj->object_id = 0;
+	set_object_id(obj, 0);
       }
 
       // объект удалён, имеет один тип с новым или новый временный, -
       // информация об удалении не нужна, использовать ALTER
       if ((pcmd->mstype == obj->type || obj->type == R_TEMP)
 	  && pcmd->act == DROP) {
-	obj->object_id = pcmd->obj->object_id;
+	set_object_id(obj, pcmd->obj->object_id);
 
 	// не допускать пересоздание колонок IDENTITY
 	if (is_flag(pcmd, CMD_IDENTITY))
 	  set_flag(cmd, CMD_EXECUTED);
 	
-	g_sequence_remove(iter);
+	unqueue_cmd(iter);
 	iter = NULL;
 
 	// не пересоздавать схемы/таблицы
@@ -546,9 +1101,9 @@ static void crep_object(const char *path, struct sqlcmd *cmd,
       // если новый объект - колонка, возможно, создана с таблицей
       if (iter != NULL && cmd->mstype != R_TEMP
 	  && pcmd->mstype == R_TEMP && pcmd->act == CREP) {
-	obj->object_id = pcmd->obj->object_id;
+	set_object_id(obj, pcmd->obj->object_id);
 
-       	g_sequence_remove(iter);
+	unqueue_cmd(iter);
 	g_hash_table_remove(cache.mask_table, cmd->path);
 	
 	stop = FALSE;
@@ -557,15 +1112,19 @@ static void crep_object(const char *path, struct sqlcmd *cmd,
       if (stop) {
 	break;
       } else {
-	iter = g_sequence_get_end_iter(deploy.sql_seq);
+	// очередь изменилась, начать с последней команды
+	g_ptr_array_free(iters, TRUE);
+	iters = collect_cmds(cmd, obj);
+	i = 0;
 	stop = TRUE;
       }
       
     }
     
   }
+  g_ptr_array_free(iters, TRUE);
 
-  cmd->obj = ms2sqlfs(obj);
+  cmd->obj = copy_object(obj);
   
   if (stop) {
 
@@ -612,7 +1171,7 @@ static struct sqlcmd * drop_object(const char *path, struct sqlcmd *cmd,
 				   struct sqlfs_ms_obj *obj)
 {
   cmd->path = g_strdup(path);
-  cmd->obj = ms2sqlfs(obj);
+  cmd->obj = copy_object(obj);
   cmd->mstype = obj->type;
   
   if (obj->type == R_COL && obj->column)
@@ -624,11 +1183,14 @@ static struct sqlcmd * drop_object(const char *path, struct sqlcmd *cmd,
   cmd->act = DROP;
 
   if (IS_DIR(obj)) {
-    GSequenceIter *iter = g_sequence_get_end_iter(deploy.sql_seq);
-    gboolean is_remove = FALSE;
-    while(!g_sequence_iter_is_begin(iter)) {
-      iter = g_sequence_iter_prev(iter);
-      struct sqlcmd *pcmd = g_sequence_get(iter);
+    GPtrArray *iters = g_ptr_array_new();
+
+    append_index(iters, deploy.path_index, cmd->path);
+    append_subtree(iters, cmd->path);
+
+    guint i;
+    for (i = 0; i < iters->len; i++) {
+      struct sqlcmd *pcmd = g_sequence_get(g_ptr_array_index(iters, i));
 
       // оставить операции над таблицами и модулями
       if (cmd->mstype == D_SCHEMA && pcmd->mstype != D_U
@@ -643,6 +1205,8 @@ static struct sqlcmd * drop_object(const char *path, struct sqlcmd *cmd,
       }
 
     }
+
+    g_ptr_array_free(iters, TRUE);
   }
   
   do_mask(path, cmd);
@@ -654,18 +1218,18 @@ static struct sqlcmd * rename_obj(const char *oldname, const char *newname,
 {
   cmd->path = g_strdup(oldname);
   cmd->path2 = g_strdup(newname);
-  cmd->obj = ms2sqlfs(obj);
+  cmd->obj = copy_object(obj);
   cmd->mstype = obj->type;
   cmd->act = RENAME;
   
   do_mask(oldname, cmd);
   do_mask(newname, cmd);
-  g_sequence_append(deploy.sql_seq, cmd);
+  queue_cmd(NULL, cmd);
 }
 
-static inline void cut_deploy_sql()
+static inline void cut_deploy_sql(GSequence *seq)
 {
-  GSequenceIter *iter = g_sequence_get_begin_iter(deploy.sql_seq);
+  GSequenceIter *iter = g_sequence_get_begin_iter(seq);
   GString *sql = g_string_new(NULL);
 
   while(!g_sequence_iter_is_end(iter)) {
@@ -688,199 +1252,1106 @@ static inline void cut_deploy_sql()
       g_string_truncate(sql, 0);
       
     }
-    
-    iter = g_sequence_iter_next(iter); 
+    
+    iter = g_sequence_iter_next(iter); 
+  }
+
+  g_string_free(sql, TRUE);
+}
+
+/*
+ * Выполнить накопленный пакет команд. Ошибка привязывается к пути,
+ * если в пакете одна команда.
+ */
+static void flush_batch(GString *batch, struct sqlcmd *first, guint count,
+			msctx_t *ctx, GError **error)
+{
+  GError *terr = NULL;
+
+  if (batch->len > 0)
+    exec_sql_batch(batch->str, ctx, &terr);
+
+  g_string_truncate(batch, 0);
+
+  if (terr != NULL && count == 1)
+    g_prefix_error(&terr, "%s: ", first->path);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+}
+
+/*
+ * Выполнить команды в одной транзакции. Подряд идущие команды собираются
+ * в пакеты до batch_size байт, 0 - каждая команда отдельно. Модули и схемы
+ * должны быть первыми в пакете и всегда выполняются отдельно.
+ * Вернёт TRUE, если ошибка в пакете и путь команды неизвестен.
+ */
+static gboolean run_deploy_sql(GPtrArray *cmds, gsize batch_size,
+			       GError **error)
+{
+  GError *terr = NULL;
+  msctx_t *ctx = get_msctx(&terr);
+  GString *sql = g_string_new(NULL), *batch = g_string_new(NULL);
+  struct sqlcmd *first = NULL;
+  guint i, count = 0;
+  gboolean in_batch = FALSE;
+
+  if (terr == NULL) {
+    g_string_append(sql, "SET XACT_ABORT ON\n");
+    g_string_append(sql, "BEGIN TRANSACTION\n");
+
+    exec_sql_cmd(sql->str, ctx, &terr);
+  }
+
+  for (i = 0; i < cmds->len; i++) {
+    struct sqlcmd *cmd = g_ptr_array_index(cmds, i);
+
+    if (cmd->sql != NULL && terr == NULL && !is_flag(cmd, CMD_DISABLED)
+	&& !is_flag(cmd, CMD_EXECUTED)) {
+      gsize len = strlen(cmd->sql);
+
+      if (!batch_size || IS_MODCMD(cmd)
+	  || (batch->len > 0 && batch->len + len + 1 > batch_size)) {
+	flush_batch(batch, first, count, ctx, &terr);
+	in_batch = (terr != NULL && count > 1);
+	count = 0;
+      }
+
+      if (terr == NULL) {
+	if (!batch_size || IS_MODCMD(cmd)) {
+	  exec_sql_cmd(cmd->sql, ctx, &terr);
+
+	  if (terr != NULL)
+	    g_prefix_error(&terr, "%s: ", cmd->path);
+	}
+	else {
+	  if (!count++)
+	    first = cmd;
+
+	  g_string_append_len(batch, cmd->sql, len);
+	  g_string_append_c(batch, '\n');
+	}
+      }
+    }
+  }
+
+  if (terr == NULL) {
+    flush_batch(batch, first, count, ctx, &terr);
+    in_batch = (terr != NULL && count > 1);
+  }
+
+  // если ошибка, - откатить транзакцию, иначе - зафиксировать
+  g_string_truncate(sql, 0);
+  if (terr != NULL) {
+    GError *rerr = NULL;
+
+    g_string_append(sql, "IF @@TRANCOUNT > 0");
+    g_string_append(sql, " ROLLBACK TRANSACTION\n");
+
+    exec_sql_cmd(sql->str, ctx, &rerr);
+
+    if (rerr != NULL) {
+      g_clear_error(&terr);
+      g_propagate_error(&terr, rerr);
+      in_batch = FALSE;
+    }
+  }
+  else {
+    g_string_append(sql, "IF @@TRANCOUNT > 0\n");
+    g_string_append(sql, " COMMIT TRANSACTION\n");
+
+    exec_sql_cmd(sql->str, ctx, &terr);
+  }
+  
+  g_string_free(batch, TRUE);
+  g_string_free(sql, TRUE);
+  close_sql(ctx);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+  else
+    in_batch = FALSE;
+
+  return in_batch;
+}
+
+static void deploy_cmds(GPtrArray *cmds, GError **error)
+{
+  GError *terr = NULL;
+  gsize batch_size = MAX(get_context()->deplbatch, 0) * 1024;
+
+  // транзакция пакета откачена: найти команду с ошибкой,
+  // повторив команды по одной
+  if (run_deploy_sql(cmds, batch_size, &terr)) {
+    g_clear_error(&terr);
+    run_deploy_sql(cmds, 0, &terr);
+  }
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+}
+
+/*
+ * Группа независимых команд: выполняется на своём подключении
+ * в своей транзакции
+ */
+struct deploy_group {
+  GString *name;
+  GPtrArray *cmds;
+  GError *error;
+};
+
+static void free_deploy_group(gpointer data)
+{
+  struct deploy_group *group = (struct deploy_group *) data;
+
+  if (group->error != NULL)
+    g_error_free(group->error);
+
+  g_ptr_array_free(group->cmds, TRUE);
+  g_string_free(group->name, TRUE);
+  g_free(group);
+}
+
+static void deploy_group_thread(gpointer data, gpointer user_data)
+{
+  struct deploy_group *group = (struct deploy_group *) data;
+
+  deploy_cmds(group->cmds, &group->error);
+}
+
+#define IS_IDCHAR(c) (g_ascii_isalnum(c) || (guchar) (c) >= 0x80	\
+		      || (c) == '_' || (c) == '@' || (c) == '#' || (c) == '$')
+
+/*
+ * Упоминается ли имя схемы в тексте команды как отдельный идентификатор
+ */
+static gboolean refers_schema(const gchar *text, const gchar *name)
+{
+  gsize len = strlen(name);
+  const gchar *pos = text;
+
+  while (len > 0 && (pos = strstr(pos, name)) != NULL) {
+    if ((pos == text || !IS_IDCHAR(pos[-1])) && !IS_IDCHAR(pos[len]))
+      return TRUE;
+
+    pos += len;
+  }
+
+  return FALSE;
+}
+
+static const gchar * add_schema(GHashTable *roots, GStringChunk *chunk,
+				const char *path)
+{
+  const gchar *pn = g_path_skip_root(path);
+  if (pn == NULL)
+    pn = path;
+
+  const gchar *sep = strchr(pn, G_DIR_SEPARATOR);
+  gchar *schema = (sep) ? g_strndup(pn, sep - pn) : g_strdup(pn);
+  const gchar *name = g_string_chunk_insert_const(chunk, schema);
+  g_free(schema);
+
+  if (!g_hash_table_contains(roots, name))
+    g_hash_table_insert(roots, (gpointer) name, (gpointer) name);
+
+  return name;
+}
+
+static const gchar * group_root(GHashTable *roots, const gchar *name)
+{
+  const gchar *parent;
+  while ((parent = g_hash_table_lookup(roots, name)) != name)
+    name = parent;
+
+  return name;
+}
+
+static void join_groups(GHashTable *roots, const gchar *a, const gchar *b)
+{
+  a = group_root(roots, a);
+  b = group_root(roots, b);
+
+  if (a != b)
+    g_hash_table_insert(roots, (gpointer) b, (gpointer) a);
+}
+
+/*
+ * Разбить команды на независимые группы по схемам. Схемы объединяются,
+ * если команда одной схемы ссылается на другую (FK, модули, типы,
+ * переименование). Неуточнённые имена разрешаются в схеме dbo, поэтому
+ * команды, кроме индексов и ключей, объединяются с dbo. Удаления
+ * выполняются одной группой: зависимости удаляемых объектов неизвестны.
+ */
+static GPtrArray * split_deploy(GPtrArray *cmds)
+{
+  GHashTable *roots = g_hash_table_new(g_str_hash, g_str_equal);
+  GHashTable *groups = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GStringChunk *chunk = g_string_chunk_new(256);
+  const gchar **keys = g_new0(const gchar *, cmds->len);
+  const gchar *drop = NULL, *dbo = NULL;
+  GPtrArray *result = g_ptr_array_new_with_free_func(free_deploy_group);
+  guint i, j;
+
+  for (i = 0; i < cmds->len; i++) {
+    struct sqlcmd *cmd = g_ptr_array_index(cmds, i);
+    keys[i] = add_schema(roots, chunk, cmd->path);
+
+    if (cmd->path2 != NULL)
+      join_groups(roots, keys[i], add_schema(roots, chunk, cmd->path2));
+
+    if (cmd->act == DROP) {
+      if (drop != NULL)
+	join_groups(roots, drop, keys[i]);
+      else
+	drop = keys[i];
+    }
+  }
+
+  GList *names = g_hash_table_get_keys(roots), *link;
+  GPtrArray *folded = g_ptr_array_new_with_free_func(g_free);
+  for (link = names; link != NULL; link = g_list_next(link)) {
+    g_ptr_array_add(folded, g_utf8_casefold(link->data, -1));
+
+    if (!g_ascii_strcasecmp(link->data, "dbo"))
+      dbo = link->data;
+  }
+
+  for (i = 0; i < cmds->len; i++) {
+    struct sqlcmd *cmd = g_ptr_array_index(cmds, i);
+    if (cmd->sql == NULL || is_flag(cmd, CMD_DISABLED))
+      continue;
+
+    if (dbo != NULL && cmd->mstype != R_PK && cmd->mstype != R_UQ
+	&& cmd->mstype != R_X && cmd->mstype != D_SCHEMA)
+      join_groups(roots, keys[i], dbo);
+
+    gchar *text = g_utf8_casefold(cmd->sql, -1);
+    for (j = 0, link = names; link != NULL; j++, link = g_list_next(link)) {
+      if (group_root(roots, link->data) != group_root(roots, keys[i])
+	  && refers_schema(text, g_ptr_array_index(folded, j)))
+	join_groups(roots, keys[i], link->data);
+    }
+    g_free(text);
+  }
+
+  for (link = names; link != NULL; link = g_list_next(link)) {
+    const gchar *root = group_root(roots, link->data);
+    struct deploy_group *group = g_hash_table_lookup(groups, root);
+
+    if (group == NULL) {
+      group = g_try_new0(struct deploy_group, 1);
+      group->name = g_string_new(NULL);
+      group->cmds = g_ptr_array_new();
+
+      g_hash_table_insert(groups, (gpointer) root, group);
+      g_ptr_array_add(result, group);
+    }
+
+    if (group->name->len > 0)
+      g_string_append(group->name, ", ");
+    g_string_append(group->name, link->data);
+  }
+
+  // порядок команд внутри группы - порядок очереди
+  for (i = 0; i < cmds->len; i++) {
+    struct deploy_group *group = g_hash_table_lookup(groups,
+						     group_root(roots, keys[i]));
+    g_ptr_array_add(group->cmds, g_ptr_array_index(cmds, i));
+  }
+
+  g_ptr_array_free(folded, TRUE);
+  g_list_free(names);
+  g_free(keys);
+  g_string_chunk_free(chunk);
+  g_hash_table_destroy(groups);
+  g_hash_table_destroy(roots);
+
+  return result;
+}
+
+/*
+ * Выполнить группы параллельно. Каждая группа фиксируется отдельно:
+ * при ошибке откатывается только её транзакция.
+ */
+static void deploy_groups(GPtrArray *groups, int workers, GError **error)
+{
+  GError *terr = NULL;
+  guint i, failed = 0;
+
+  GThreadPool *pool = g_thread_pool_new(&deploy_group_thread, NULL,
+					workers, FALSE, &terr);
+
+  // без пула - группы по очереди в текущем потоке
+  if (pool == NULL) {
+    g_clear_error(&terr);
+
+    for (i = 0; i < groups->len; i++)
+      deploy_group_thread(g_ptr_array_index(groups, i), NULL);
+  }
+  else {
+    for (i = 0; i < groups->len; i++) {
+      // задача остаётся в очереди пула, даже если поток не создан
+      g_thread_pool_push(pool, g_ptr_array_index(groups, i), &terr);
+      g_clear_error(&terr);
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+  }
+
+  for (i = 0; i < groups->len; i++) {
+    struct deploy_group *group = g_ptr_array_index(groups, i);
+
+    if (group->error != NULL) {
+      g_printerr("Deploy of schemas %s rolled back: %s", group->name->str,
+		 group->error->message);
+      failed++;
+    }
+  }
+
+  if (failed > 0) {
+    g_set_error(&terr, EEXEC, EEXEC,
+		"%d: %u of %u deploy groups rolled back, others committed\n",
+		__LINE__, failed, groups->len);
+  }
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+}
+
+static inline void do_deploy_sql(GSequence *seq, GError **error)
+{
+  GError *terr = NULL;
+  sqlctx_t *sqlctx = get_context();
+  GSequenceIter *iter = g_sequence_get_begin_iter(seq);
+  GPtrArray *cmds = g_ptr_array_new(), *groups = NULL;
+
+  while(!g_sequence_iter_is_end(iter)) {
+    g_ptr_array_add(cmds, g_sequence_get(iter));
+    iter = g_sequence_iter_next(iter);
+  }
+
+  // потоков не больше свободных сейчас подключений без одного: оно
+  // остаётся запросам ФС. Горячий старт и опрос изменений берут
+  // подключения из того же пула, поэтому считаются только свободные
+  int workers = get_count_free_contexts() - 1;
+
+  // параллельно нужно хотя бы два подключения помимо запросов ФС
+  if (sqlctx->deplparallel && workers > 1)
+    groups = split_deploy(cmds);
+
+  if (groups != NULL && groups->len > 1)
+    deploy_groups(groups, workers, &terr);
+  else
+    deploy_cmds(cmds, &terr);
+
+  if (groups != NULL)
+    g_ptr_array_free(groups, TRUE);
+  g_ptr_array_free(cmds, TRUE);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+}
+
+/*
+ * Забрать очередь для сброса, правки продолжают копиться в новой очереди
+ */
+static GSequence * swap_queue()
+{
+  GSequence *seq = deploy.sql_seq;
+
+  g_hash_table_remove_all(deploy.path_index);
+  g_hash_table_remove_all(deploy.dir_index);
+  deploy.sql_seq = g_sequence_new(&free_sqlcmd_object);
+
+  // правки во время сброса копятся к следующему сроку
+  deploy.first = deploy.last = 0;
+  deploy.flush = FALSE;
+  deploy.taken++;
+
+  return seq;
+}
+
+/*
+ * Сбросить кэш по пути сброшенной команды. APP-объект остаётся,
+ * если путь снова изменён и ждёт следующего сброса.
+ */
+static void release_path(const char *path)
+{
+  g_mutex_lock(&cache.m);
+  if (hot.loading)
+    g_hash_table_add(hot.changed, g_strdup(path));
+
+  remove_tree(cache.root, path, NODE_DB);
+
+  if (!g_hash_table_contains(deploy.path_index, path))
+    remove_tree(cache.root, path, NODE_APP);
+  g_mutex_unlock(&cache.m);
+}
+
+static gboolean is_released_mask(gpointer key, gpointer value,
+				 gpointer user_data)
+{
+  return g_hash_table_contains((GHashTable *) user_data, value);
+}
+
+/*
+ * Убрать за сброшенной очередью, вызывается под deploy.lock
+ */
+static void finish_deploy(GSequence *seq)
+{
+  GHashTable *done = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GSequenceIter *iter = g_sequence_get_begin_iter(seq);
+
+  while(!g_sequence_iter_is_end(iter)) {
+    struct sqlcmd *cmd = g_sequence_get(iter);
+    g_hash_table_add(done, cmd);
+
+    // в том числе временные схемы и таблицы
+    release_path(cmd->path);
+    if (cmd->path2 != NULL)
+      release_path(cmd->path2);
+
+    if (cmd->obj != NULL)
+      drop_text(cmd->obj->object_id);
+
+    iter = g_sequence_iter_next(iter);
+  }
+
+  // маскировка только сброшенных команд, новые команды маскируют сами
+  g_hash_table_foreach_remove(cache.mask_table, &is_released_mask, done);
+  g_hash_table_destroy(done);
+
+  // ничего не ждёт сброса: очистить APP-кэш целиком
+  if (!g_sequence_get_length(deploy.sql_seq)) {
+    g_mutex_lock(&cache.m);
+    clear_tree(cache.root, NODE_APP);
+    g_mutex_unlock(&cache.m);
+  }
+
+  g_sequence_free(seq);
+}
+
+/*
+ * Срок сброса очереди: deploy_time после последней правки, но не позже
+ * deploy_max после первой. По запросу и при завершении - немедленно.
+ */
+static gint64 deploy_deadline()
+{
+  sqlctx_t *sqlctx = get_context();
+  gint64 deadline;
+
+  if (deploy.flush || !deploy.run)
+    return 0;
+
+  deadline = deploy.last + (gint64) sqlctx->depltime * G_TIME_SPAN_SECOND;
+  if (sqlctx->maxdepl > 0)
+    deadline = MIN(deadline, deploy.first
+		   + (gint64) sqlctx->maxdepl * G_TIME_SPAN_SECOND);
+
+  return deadline;
+}
+
+static gpointer deploy_thread(gpointer data) {
+  g_mutex_lock(&deploy.lock);
+
+  // при завершении накопленные правки сбрасываются сразу
+  while (deploy.run || g_sequence_get_length(deploy.sql_seq) > 0) {
+    if (!g_sequence_get_length(deploy.sql_seq)) {
+      deploy.flush = FALSE;
+      g_cond_wait(&deploy.cond, &deploy.lock);
+      continue;
+    }
+
+    // правка или запрос сброса разбудят поток и пересчитают срок
+    gint64 deadline = deploy_deadline();
+    if (g_get_monotonic_time() < deadline) {
+      g_cond_wait_until(&deploy.cond, &deploy.lock, deadline);
+      continue;
+    }
+
+    GError *terr = NULL;
+    GSequence *seq = swap_queue();
+    g_mutex_unlock(&deploy.lock);
+
+    // сервер может отвечать долго: правки и чтение не ждут сброса
+    cut_deploy_sql(seq);
+    do_deploy_sql(seq, &terr);
+
+    g_mutex_lock(&deploy.lock);
+    finish_deploy(seq);
+
+    deploy.done = deploy.taken;
+    if (terr != NULL)
+      deploy.failed = deploy.taken;
+    g_cond_broadcast(&deploy.done_cond);
+
+    if (terr != NULL) {
+#ifdef SQLDEBUG
+      g_message("DEPLOY ERROR: %s\n", terr->message);
+#endif
+      g_error_free(terr);
+    }
+  }
+
+  g_mutex_unlock(&deploy.lock);
+
+  return 0;
+}
+
+void flush_deploy(GError **error)
+{
+  GError *terr = NULL;
+
+  g_mutex_lock(&deploy.lock);
+
+  // очередь с правками вызывающего: новая или уже выполняемая,
+  // 0 - ждать нечего
+  guint64 target = 0;
+  if (g_sequence_get_length(deploy.sql_seq) > 0) {
+    target = deploy.taken + 1;
+    deploy.flush = TRUE;
+    g_cond_signal(&deploy.cond);
+  }
+  else
+    if (deploy.done < deploy.taken)
+      target = deploy.taken;
+
+  while (deploy.done < target)
+    g_cond_wait(&deploy.done_cond, &deploy.lock);
+
+  // ошибка сообщается однажды и только для ожидаемой очереди
+  if (target > 0 && deploy.failed == target) {
+    g_set_error(&terr, EEXEC, EEXEC,
+		"%d: Deploy failed\n", __LINE__);
+    deploy.failed = 0;
+  }
+
+  g_mutex_unlock(&deploy.lock);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+}
+
+static void free_sch_stat(gpointer data)
+{
+  struct sch_stat *stat = (struct sch_stat *) data;
+
+  if (stat->mdate != NULL)
+    g_free(stat->mdate);
+
+  g_free(stat);
+}
+
+/*
+ * Сбросить DB-кэш содержимого директории. Вызывается под cache.m:
+ * объекты, выданные читателям, освобождает последний free_ms_obj
+ */
+static void expire_dir(struct sqlfs_node *dir)
+{
+  if (!dir)
+    return ;
+
+  if (dir->children != NULL) {
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, dir->children);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      clear_tree((struct sqlfs_node *) value, NODE_DB);
+    }
+
+    // опустевшие узлы удаляются
+    clear_node_dir(dir, NODE_DB);
+  }
+
+  dir->listed = 0;
+}
+
+/*
+ * Сбросить DB-кэш объекта уровня схемы по идентификатору. Вызывается
+ * под cache.m
+ */
+static void expire_object(struct sqlfs_node *dir, int object_id)
+{
+  if (!dir)
+    return ;
+
+  if (dir->children != NULL) {
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, dir->children);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      struct sqlfs_node *child = (struct sqlfs_node *) value;
+      if (child->obj[NODE_DB] && child->obj[NODE_DB]->object_id == object_id)
+	clear_tree(child, NODE_DB);
+    }
+  }
+
+  // объект мог быть переименован
+  dir->listed = 0;
+}
+
+static void apply_changes(GList *changes)
+{
+  GList *wrk = NULL;
+  GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+  GHashTable *dirty = g_hash_table_new_full(g_str_hash, g_str_equal,
+					    g_free, NULL);
+  gboolean first = (watch.mdate == NULL);
+  gchar *mdate = g_strdup((watch.mdate) ? watch.mdate : "");
+
+  g_mutex_lock(&cache.m);
+  for (wrk = g_list_first(changes); wrk; wrk = g_list_next(wrk)) {
+    struct sqlfs_ms_change *change = wrk->data;
+    struct sqlfs_node *dir = find_child(cache.root, change->schema);
+    gboolean changed = TRUE;
+
+    if (g_strcmp0(change->mdate, mdate) > 0) {
+      g_free(mdate);
+      mdate = g_strdup(change->mdate);
+    }
+
+    if (change->is_stat) {
+      g_hash_table_add(seen, change->schema);
+
+      struct sch_stat *stat = g_hash_table_lookup(watch.stat_table,
+						  change->schema);
+      if (stat == NULL) {
+	stat = g_try_new0(struct sch_stat, 1);
+	g_hash_table_insert(watch.stat_table, g_strdup(change->schema), stat);
+
+	// новая схема
+	if (!first)
+	  cache.root->listed = 0;
+	else
+	  changed = FALSE;
+      }
+      else
+	if (stat->count != change->count) {
+	  // объекты созданы или удалены
+	  expire_dir(dir);
+	}
+	else
+	  if (g_strcmp0(stat->mdate, change->mdate)) {
+	    // число прежнее, но объект мог быть удалён и создан другой
+	    expire_dir(dir);
+	  }
+	  else
+	    changed = FALSE;
+
+      stat->count = change->count;
+      if (stat->mdate != NULL)
+	g_free(stat->mdate);
+      stat->mdate = g_strdup(change->mdate);
+    }
+    else
+      expire_object(dir, change->object_id);
+
+    if (changed)
+      g_hash_table_add(dirty, g_strconcat(G_DIR_SEPARATOR_S, change->schema, NULL));
+  }
+
+  // удалённые схемы
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, watch.stat_table);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    if (!g_hash_table_contains(seen, key)) {
+      clear_tree(find_child(cache.root, key), NODE_DB);
+      cache.root->listed = 0;
+      g_hash_table_add(dirty, g_strconcat(G_DIR_SEPARATOR_S, key, NULL));
+      g_hash_table_iter_remove(&iter);
+    }
+  }
+
+  // загружаемая схема уже устарела
+  if (hot.loading) {
+    g_hash_table_iter_init(&iter, dirty);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+      g_hash_table_add(hot.changed, g_strdup(key));
+  }
+  g_mutex_unlock(&cache.m);
+
+  if (watch.mdate != NULL)
+    g_free(watch.mdate);
+  watch.mdate = mdate;
+
+  // в изменённых схемах объекты могли появиться
+  g_hash_table_iter_init(&iter, dirty);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    drop_negative(key);
+  }
+
+  g_hash_table_destroy(dirty);
+  g_hash_table_destroy(seen);
+}
+
+static gpointer watch_thread(gpointer data) {
+  g_mutex_lock(&watch.lock);
+
+  while (watch.run) {
+    gint64 end_time = g_get_monotonic_time()
+      + get_context()->polltime * G_TIME_SPAN_SECOND;
+
+    while (watch.run) {
+      if (!g_cond_wait_until(&watch.cond, &watch.lock, end_time))
+	break;
+    }
+
+    if (!watch.run)
+      break;
+
+    g_mutex_unlock(&watch.lock);
+
+    GError *terr = NULL;
+    msctx_t *ctx = get_msctx(&terr);
+    if (terr == NULL) {
+      GList *changes = fetch_changes(watch.mdate, ctx, &terr);
+      close_sql(ctx);
+
+      if (terr == NULL)
+	apply_changes(changes);
+
+      g_list_free_full(changes, free_ms_change);
+    }
+
+    if (terr != NULL) {
+      g_message("WATCH: #%d: %s\n", terr->code, terr->message);
+      g_error_free(terr);
+    }
+
+    g_mutex_lock(&watch.lock);
   }
 
-  g_string_free(sql, TRUE);
+  g_mutex_unlock(&watch.lock);
+
+  return 0;
 }
 
-static gboolean clear_tbl_files(gpointer key, gpointer value,
-				gpointer user_data)
+/*
+ * Путь или одна из его директорий изменены во время загрузки схемы
+ */
+static gboolean is_hot_changed(const char *path)
 {
-  if (key != NULL && user_data != NULL) {
-    gchar *path = (gchar *) key, *pathdir = (gchar *) user_data;
-    if (g_str_has_prefix(key, pathdir))
-      return TRUE;
-  }
+  gboolean res = FALSE;
+  gchar *wrk = g_strdup(path);
 
-  return FALSE;
-}
+  while (!res && g_strcmp0(wrk, G_DIR_SEPARATOR_S)
+	 && g_strcmp0(wrk, ".")) {
+    res = g_hash_table_contains(hot.changed, wrk);
 
-static gboolean clear_dir_files(gpointer key, gpointer value,
-				gpointer user_data)
-{
-  gboolean result = FALSE;
-  if (key != NULL) {
-    gchar *path = (gchar *) key, *pathdir = (gchar *) user_data;
-    gchar *dc = g_path_get_dirname(path);
-    if (!g_strcmp0(dc, pathdir)) {
-      result = TRUE;
-    }
-    g_free(dc);
+    gchar *dir = g_path_get_dirname(wrk);
+    g_free(wrk);
+    wrk = dir;
   }
+  g_free(wrk);
 
-  return result;
+  return res;
 }
 
-static inline void do_deploy_sql()
+/*
+ * Загрузить в кэш объекты одной схемы через временные таблицы
+ */
+static void hotstart_schema(const char *name, msctx_t *ctx, GError **error)
 {
-  GSequenceIter *iter = g_sequence_get_begin_iter(deploy.sql_seq);
   GError *terr = NULL;
-  msctx_t *ctx = get_msctx(&terr);
-  GString *sql = g_string_new(NULL);
-  if (terr == NULL) {
-    g_string_append(sql, "SET XACT_ABORT ON\n");
-    g_string_append(sql, "BEGIN TRANSACTION\n");
+  GList *wrk = NULL, *list = NULL;
 
-    exec_sql_cmd(sql->str, ctx, &terr);
-  }
+  g_mutex_lock(&cache.m);
+  hot.loading = TRUE;
+  g_hash_table_remove_all(hot.changed);
+  g_mutex_unlock(&cache.m);
 
-  while(!g_sequence_iter_is_end(iter)) {
-    struct sqlcmd *cmd = g_sequence_get(iter);
+  list = fetch_schemas(name, ctx, TRUE, &terr);
 
-    // в том числе временные схемы и таблицы
-    SAFE_REMOVE_ALL(cmd->path);
+  if (terr == NULL)
+    list = g_list_concat(list, fetch_schema_obj(FALSE, NULL, ctx, &terr));
 
-    if (cmd->sql != NULL && terr == NULL && !is_flag(cmd, CMD_DISABLED)
-	&& !is_flag(cmd, CMD_EXECUTED)) {
+  if (terr == NULL)
+    list = g_list_concat(list, fetch_table_obj(FALSE, FALSE, NULL, ctx, &terr));
 
-      exec_sql_cmd(cmd->sql, ctx, &terr);
-      
-      // если ошибка, - откатить транзакцию
-      if (terr != NULL) {
-	GError *rerr = NULL;
+  if (terr == NULL) {
+    gint64 now = g_get_monotonic_time();
+
+    // очередь сброса не меняется, пока объекты кладутся в кэш
+    lock_cache();
+    g_mutex_lock(&cache.m);
+    for (wrk = g_list_first(list); wrk; wrk = g_list_next(wrk)) {
+      struct sqlfs_ms_obj *object = wrk->data;
+      gchar *str = object->name;
+      object->name = g_path_get_basename(str);
+
+      // объект изменён через ФС после выборки или ждёт сброса
+      if (is_hot_changed(str) || is_masked(str)
+	  || g_hash_table_contains(deploy.path_index, str)
+	  || lookup_tree(cache.root, str, NODE_APP)) {
+	free_ms_obj(object);
+	g_free(str);
+	continue;
+      }
 
-	g_string_truncate(sql, 0);
-	g_string_append(sql, "IF @@TRANCOUNT > 0");
-	g_string_append(sql, " ROLLBACK TRANSACTION\n");
+      struct sqlfs_node *node = make_node(cache.root, str);
 
-	exec_sql_cmd(sql->str, ctx, &rerr);
+      // содержимое схем и таблиц выбрано полностью, если в директории
+      // нет правок
+      if (IS_DIR(object)
+	  && (!node->pending || !g_hash_table_size(node->pending))
+	  && !g_hash_table_contains(deploy.dir_index, str))
+	node->listed = now;
+      g_free(str);
 
-	if (rerr != NULL) {
-	  g_clear_error(&terr);
-	  g_propagate_error(&terr, rerr);
-	}
-      }
-      
+      // объекты, найденные по запросу, не заменяются
+      if (!node->obj[NODE_DB])
+	set_node_obj(node, NODE_DB, object);
+      else
+	free_ms_obj(object);
     }
-    
-    iter = g_sequence_iter_next(iter);
+    g_mutex_unlock(&cache.m);
+    g_mutex_unlock(&deploy.lock);
   }
+  else
+    g_list_free_full(list, free_ms_obj);
 
-  // если нет ошибки, - зафиксировать транзакцию
-  if (terr == NULL) {
-    g_string_truncate(sql, 0);
-    g_string_append(sql, "IF @@TRANCOUNT > 0\n");
-    g_string_append(sql, " COMMIT TRANSACTION\n");
+  g_mutex_lock(&cache.m);
+  hot.loading = FALSE;
+  g_hash_table_remove_all(hot.changed);
+  g_mutex_unlock(&cache.m);
 
-    exec_sql_cmd(sql->str, ctx, &terr);
-  }
-  
-  g_string_free(sql, TRUE);
-  close_sql(ctx);
+  g_list_free(list);
 
-  g_sequence_remove_range(g_sequence_get_begin_iter(deploy.sql_seq),
-			  g_sequence_get_end_iter(deploy.sql_seq));
+  if (terr != NULL)
+    g_propagate_error(error, terr);
 }
 
-static gpointer deploy_thread(gpointer data) {
-  while (deploy.run) {
-    g_mutex_lock(&deploy.lock);
+static gpointer hotstart_thread(gpointer data) {
+  GList *names = (GList *) data, *wrk = NULL;
+  GError *terr = NULL;
+  GString *create = g_string_new(NULL);
+
+  g_string_append(create, "CREATE TABLE #schemas (");
+  g_string_append(create, "dir_path NVARCHAR(MAX), sch_id INT)\n");
     
-    while(!g_sequence_get_length(deploy.sql_seq) && deploy.run) {
-      g_cond_wait(&deploy.cond, &deploy.lock);
-    }
+  g_string_append(create, "CREATE TABLE #sch_objs (");
+  g_string_append(create, "dir_path NVARCHAR(MAX), obj_id INT");
+  g_string_append(create, ", obj_type NVARCHAR(5), ctime BIGINT");
+  g_string_append(create, ", mtime BIGINT, def_len INT NULL )\n");
 
-    if (!deploy.run) {
-      g_mutex_unlock(&deploy.lock);
-      break;
-    }
+  // подключение берётся на одну схему, чтобы запросы ФС не ждали всю
+  // загрузку; временные таблицы живут в сессии и удаляются до возврата
+  // подключения в пул
+  for (wrk = names; wrk && hot.run && terr == NULL; wrk = g_list_next(wrk)) {
+    msctx_t *ctx = get_msctx(&terr);
 
-    gdouble tm = g_timer_elapsed(deploy.timer, NULL);
-    if (tm > get_context()->depltime) {
-      cut_deploy_sql();
-      do_deploy_sql();
+    if (terr == NULL) {
+      exec_sql_cmd(create->str, ctx, &terr);
 
-      // очистить маскировку
-      g_hash_table_remove_all(cache.mask_table);
+      if (terr == NULL) {
+	hotstart_schema(wrk->data, ctx, &terr);
 
-      // очистить APP-кэш
-      g_hash_table_remove_all(cache.app_table);
-      
-      g_timer_stop(deploy.timer);
-      g_mutex_unlock(&deploy.lock);
-    }
-    else {
-      g_mutex_unlock(&deploy.lock);
-      g_usleep((get_context()->depltime - tm) * 1000000);
+	GError *derr = NULL;
+	exec_sql_cmd("DROP TABLE #sch_objs\nDROP TABLE #schemas", ctx, &derr);
+
+	if (terr == NULL && derr != NULL)
+	  g_propagate_error(&terr, derr);
+	else
+	  if (derr != NULL)
+	    g_error_free(derr);
+      }
     }
+
+    close_sql(ctx);
+  }
+
+  g_string_free(create, TRUE);
+
+  if (terr != NULL) {
+    g_message("HOTSTART: #%d: %s\n", terr->code, terr->message);
+    g_error_free(terr);
   }
 
+  g_list_free_full(names, g_free);
+
   return 0;
 }
 
 static void hotstart(GError **error)
 {
   GError *terr = NULL;
-  GList *wrk = NULL;
-  GString *sql = g_string_new(NULL);
-  g_mutex_lock(&cache.m);
+  GList *wrk = NULL, *list = NULL, *names = NULL;
 
   msctx_t *ctx = get_msctx(&terr);
 
+  // схемы загружаются сразу, остальное - в фоне
+  if (terr == NULL)
+    list = fetch_schemas(NULL, ctx, FALSE, &terr);
+
+  close_sql(ctx);
+
   if (terr == NULL) {
+    g_mutex_lock(&cache.m);
+    for (wrk = g_list_first(list); wrk; wrk = g_list_next(wrk)) {
+      struct sqlfs_ms_obj *object = wrk->data;
+      names = g_list_append(names, g_strdup(object->name));
+
+      struct sqlfs_node *node = make_child(cache.root, object->name);
+      if (!node->obj[NODE_DB])
+	set_node_obj(node, NODE_DB, object);
+      else
+	free_ms_obj(object);
+    }
+    cache.root->listed = g_get_monotonic_time();
+    g_mutex_unlock(&cache.m);
+
+    hot.run = 1;
+    hot.thread = g_thread_new(NULL, &hotstart_thread, names);
+  }
+  else
+    g_list_free_full(list, free_ms_obj);
+
+  g_list_free(list);
   
-    g_string_append(sql, "CREATE TABLE #schemas (");
-    g_string_append(sql, "dir_path NVARCHAR(MAX), sch_id INT)\n");
-    
-    g_string_append(sql, "CREATE TABLE #sch_objs (");
-    g_string_append(sql, "dir_path NVARCHAR(MAX), obj_id INT");
-    g_string_append(sql, ", obj_type NVARCHAR(5), ctime BIGINT");
-    g_string_append(sql, ", mtime BIGINT, def_len INT NULL )\n");
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+}
 
-    exec_sql_cmd(sql->str, ctx, &terr);
+/*
+ * Загрузить снимок кэша и оставить только объекты, не изменённые в БД.
+ * Вернёт количество загруженных объектов.
+ */
+static guint load_cache_snapshot()
+{
+  GError *terr = NULL;
+  GList *wrk = NULL;
+  guint count = 0;
+
+  GList *list = load_snapshot(get_context()->profile, &terr);
+  if (!list) {
+    if (terr != NULL) {
+      g_message("SNAPSHOT: #%d: %s\n", terr->code, terr->message);
+      g_error_free(terr);
+    }
+
+    return count;
   }
 
+  GHashTable *schemas = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					      NULL, g_free);
+  GHashTable *objects = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GHashTable *valid = g_hash_table_new_full(g_str_hash, g_str_equal,
+					    g_free, NULL);
+
+  msctx_t *ctx = get_msctx(&terr);
+  if (terr == NULL)
+    fetch_modify_dates(schemas, objects, ctx, &terr);
+  close_sql(ctx);
+
   if (terr == NULL) {
-    wrk = fetch_schemas(NULL, ctx, TRUE, &terr);
-    if (terr == NULL)
-      wrk = g_list_concat(wrk, fetch_schema_obj(FALSE, NULL, ctx, &terr));
+    g_mutex_lock(&cache.m);
+    for (wrk = g_list_first(list); wrk; wrk = g_list_next(wrk)) {
+      struct sqlfs_ms_obj *object = wrk->data;
+      gchar **parts = g_strsplit(g_path_skip_root(object->name),
+				 G_DIR_SEPARATOR_S, -1);
+      gboolean fresh = FALSE;
+      gpointer value = NULL;
+
+      if (object->type == D_SCHEMA) {
+	// схема с тем же идентификатором и именем
+	fresh = !g_strcmp0(g_hash_table_lookup(schemas,
+					       GINT_TO_POINTER(object->schema_id)),
+			   *parts);
+	if (fresh)
+	  g_hash_table_add(valid, g_strdup(*parts));
+      }
+      else
+	// объект не изменялся, и его схема не переименована
+	fresh = (g_hash_table_contains(valid, *parts)
+		 && g_hash_table_lookup_extended(objects,
+						 GINT_TO_POINTER(object->object_id),
+						 NULL, &value)
+		 && GPOINTER_TO_INT(value) == object->mtime);
 
-    if (terr == NULL)
-      wrk = g_list_concat(wrk, fetch_table_obj(FALSE, FALSE, NULL, ctx, &terr));
+      g_strfreev(parts);
 
-    if (terr == NULL) {
-      struct sqlfs_ms_obj *object = NULL;
-      wrk = g_list_first(wrk);
-      while (wrk) {
-	object = wrk->data;
+      if (fresh) {
 	gchar *str = object->name;
 	object->name = g_path_get_basename(str);
-	g_hash_table_insert(cache.db_table, str, object);
-	wrk = g_list_next(wrk);
+	struct sqlfs_node *node = make_node(cache.root, str);
+	g_free(str);
+
+	if (!node->obj[NODE_DB]) {
+	  set_node_obj(node, NODE_DB, object);
+	  count++;
+	  continue;
+	}
       }
-      g_list_free(wrk);
+
+      free_ms_obj(object);
     }
-    
+    g_mutex_unlock(&cache.m);
+  }
+  else {
+    g_message("SNAPSHOT: #%d: %s\n", terr->code, terr->message);
+    g_error_free(terr);
+    g_list_free_full(list, free_ms_obj);
   }
 
-  if (terr == NULL) {
-    g_string_truncate(sql, 0);
-    
-    g_string_append(sql, "DROP TABLE #sch_objs\n");
-    g_string_append(sql, "DROP TABLE #schemas");
-    
-    exec_sql_cmd(sql->str, ctx, &terr);
+  g_list_free(list);
+
+  g_hash_table_destroy(valid);
+  g_hash_table_destroy(objects);
+  g_hash_table_destroy(schemas);
+
+  return count;
+}
+
+/*
+ * Сохранить схемы и объекты уровня схемы из DB-кэша
+ */
+static void save_cache_snapshot()
+{
+  GError *terr = NULL;
+  snapshot_t *snap = new_snapshot();
+
+  g_mutex_lock(&cache.m);
+  if (cache.root->children != NULL) {
+    GHashTableIter isch, iobj;
+    gpointer key, value;
+    g_hash_table_iter_init(&isch, cache.root->children);
+    while (g_hash_table_iter_next(&isch, &key, &value)) {
+      struct sqlfs_node *sch = (struct sqlfs_node *) value;
+      struct sqlfs_ms_obj *obj = sch->obj[NODE_DB];
+      if (!obj || obj->type != D_SCHEMA)
+	continue;
+
+      gchar *path = g_strconcat(G_DIR_SEPARATOR_S, sch->name, NULL);
+      add_snapshot(snap, path, obj);
+      g_free(path);
+
+      if (!sch->children)
+	continue;
+
+      g_hash_table_iter_init(&iobj, sch->children);
+      while (g_hash_table_iter_next(&iobj, &key, &value)) {
+	struct sqlfs_node *node = (struct sqlfs_node *) value;
+	obj = node->obj[NODE_DB];
+	if (!obj || is_temp(obj))
+	  continue;
+
+	path = g_strjoin(G_DIR_SEPARATOR_S, "", sch->name, node->name, NULL);
+	add_snapshot(snap, path, obj);
+	g_free(path);
+      }
+    }
   }
-  
-  g_string_free(sql, TRUE);
-  close_sql(ctx);
-  
   g_mutex_unlock(&cache.m);
-  
-  if (terr != NULL)
-    g_propagate_error(error, terr);
+
+  save_snapshot(snap, get_context()->profile, &terr);
+
+  if (terr != NULL) {
+    g_message("SNAPSHOT: #%d: %s\n", terr->code, terr->message);
+    g_error_free(terr);
+  }
 }
 
 void init_cache(GError **error)
@@ -888,25 +2359,48 @@ void init_cache(GError **error)
   GError *terr = NULL;
 
   g_mutex_init(&cache.m);
-  cache.db_table = g_hash_table_new_full(g_str_hash, g_str_equal,
-					 g_free, free_ms_obj);
-  cache.app_table = g_hash_table_new_full(g_str_hash, g_str_equal,
-					  g_free, free_ms_obj);
+  cache.root = new_tree();
   cache.mask_table = g_hash_table_new_full(g_str_hash, g_str_equal,
 					   g_free, NULL);
+  cache.neg_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					  g_free, g_free);
+  cache.neg_queue = g_queue_new();
+  cache.text_table = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					   NULL, free_text_entry);
+  cache.text_queue = g_queue_new();
 
   g_mutex_init(&deploy.lock);
   g_cond_init(&deploy.cond);
+  g_cond_init(&deploy.done_cond);
   deploy.sql_seq = g_sequence_new(&free_sqlcmd_object);
-  deploy.timer = g_timer_new();
+  deploy.path_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+					    g_free, (GDestroyNotify) g_queue_free);
+  deploy.dir_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, (GDestroyNotify) g_queue_free);
   deploy.run = 1;
   deploy.thread = g_thread_new(NULL, &deploy_thread, NULL);
+
+  hot.changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
   
   init_msctx(&terr);
 
-  if (terr == NULL && get_context()->hotstart) {
+  // горячий старт не нужен, если кэш восстановлен из снимка
+  guint restored = 0;
+  if (terr == NULL && get_context()->snapshot)
+    restored = load_cache_snapshot();
+
+  if (terr == NULL && get_context()->hotstart && !restored) {
     hotstart(&terr);
   }
+
+  g_mutex_init(&watch.lock);
+  g_cond_init(&watch.cond);
+  watch.stat_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, free_sch_stat);
+  if (terr == NULL && get_context()->polltime > 0) {
+    watch.run = 1;
+    watch.thread = g_thread_new(NULL, &watch_thread, NULL);
+  }
   
   if (terr != NULL)
     g_propagate_error(error, terr);
@@ -914,22 +2408,33 @@ void init_cache(GError **error)
 
 struct sqlfs_object * find_object(const char *pathfile, GError **error)
 {
-  // отключаем таймер деплоя на время выборки из БД
-  gboolean paused = pause_timer();
+  // сброс не начнётся во время выборки из БД
+  gboolean paused = pause_deploy();
   
   GError *terr = NULL;
-  struct sqlfs_object *result;
-  struct sqlfs_ms_obj *obj = find_cache_obj(pathfile, &terr);
+  struct sqlfs_object *result = NULL;
+  struct sqlfs_ms_obj *obj = NULL;
+
+  // объект недавно не был найден в БД
+  if (is_negative(pathfile))
+    g_set_error(&terr, EENOTFOUND, EENOTFOUND,
+		"%d: Object not found\n", __LINE__);
+  else
+    obj = find_cache_obj(pathfile, &terr);
 
   if (obj == NULL && terr == NULL)
     g_set_error(&terr, EENOTFOUND, EENOTFOUND,
 		"%d: Object not found\n", __LINE__);
+
+  if (terr != NULL && terr->code == EENOTFOUND && !is_masked(pathfile))
+    add_negative(pathfile);
     
   if (terr == NULL) {
-    result = ms2sqlfs(obj);
+    result = copy_object(obj);
   }
 
-  continue_timer(paused);
+  free_ms_obj(obj);
+  continue_deploy(paused);
 
   if (terr != NULL)
     g_propagate_error(error, terr);
@@ -940,80 +2445,121 @@ struct sqlfs_object * find_object(const char *pathfile, GError **error)
 
 GList * fetch_dir_objects(const char *pathdir, GError **error)
 {
-  GList *reslist = NULL, *wrk = NULL;
+  GList *reslist = NULL, *wrk = NULL, *list = NULL;
   GError *terr = NULL;
   struct sqlfs_ms_obj *object = NULL;
   int nschema = g_strcmp0(pathdir, G_DIR_SEPARATOR_S);
 
-  // отключаем таймер деплоя на время выборки из БД
-  gboolean paused = pause_timer();
+  // сброс не начнётся во время выборки из БД
+  gboolean paused = pause_deploy();
 
   // очистить устаревшие данные из DB-кэша
-  gchar *p = g_strdup(pathdir);
-  g_hash_table_foreach_remove(cache.db_table, &clear_dir_files, p);
-  g_free(p);
+  g_mutex_lock(&cache.m);
+  struct sqlfs_node *dir = find_node(cache.root, pathdir), *child = NULL;
+  gboolean listed = is_listed(dir);
+  if (!listed)
+    clear_node_dir(dir, NODE_DB);
+  g_mutex_unlock(&cache.m);
 
-  msctx_t *ctx = get_msctx(&terr);
+  if (!listed) {
+    msctx_t *ctx = get_msctx(&terr);
 
-  // получить объекты в соответствии с уровнем
-  if (!nschema) {
-    wrk = fetch_schemas(NULL, ctx, FALSE, &terr);
-  } else {
-    object = find_cache_obj(pathdir, &terr);
-    if (terr == NULL && !g_hash_table_contains(cache.app_table, pathdir)) {
-      if (object->type == D_SCHEMA) 
-	wrk = fetch_schema_obj(object->schema_id, NULL, ctx, &terr);
-      else
-	if (object->type == D_U || object->type == D_V) {
-	  wrk = fetch_table_obj(object->schema_id, object->object_id,
-				NULL, ctx, &terr);
-	}
+    // получить объекты в соответствии с уровнем
+    if (!nschema) {
+      list = fetch_schemas(NULL, ctx, FALSE, &terr);
+    } else {
+      object = find_cache_obj(pathdir, &terr);
+
+      g_mutex_lock(&cache.m);
+      gboolean in_app = (lookup_tree(cache.root, pathdir, NODE_APP) != NULL);
+      g_mutex_unlock(&cache.m);
+
+      if (terr == NULL && !in_app) {
+	if (object->type == D_SCHEMA) 
+	  list = fetch_schema_obj(object->schema_id, NULL, ctx, &terr);
 	else
-	  g_set_error(&terr, EENOTSUP, EENOTSUP,
-		      "%d: Operation not supported", __LINE__);
+	  if (object->type == D_U || object->type == D_V) {
+	    list = fetch_table_obj(object->schema_id, object->object_id,
+				   NULL, ctx, &terr);
+	  }
+	  else
+	    g_set_error(&terr, EENOTSUP, EENOTSUP,
+			"%d: Operation not supported", __LINE__);
+      }
+
+      free_ms_obj(object);
+      object = NULL;
     }
-  }
 
-  close_sql(ctx);
+    close_sql(ctx);
+  }
 
   if (terr == NULL) {
-    
-    // добавить объекты в кэш DB, если их нет в кэше APP
-    wrk = g_list_first(wrk);
-    gchar * str = NULL;
-    while (wrk) {
-      object = wrk->data;
-      str = (nschema) ? g_strjoin(G_DIR_SEPARATOR_S, pathdir, object->name, NULL)
-	: g_strconcat(pathdir, object->name, NULL);
-      if (!g_hash_table_contains(cache.app_table, str) && !is_masked(str)) {
-	if (!g_hash_table_contains(cache.db_table, str)) {
-	  g_hash_table_insert(cache.db_table, g_strdup(str), object);
+    g_mutex_lock(&cache.m);
+    dir = make_node(cache.root, pathdir);
+
+    // добавить объекты в кэш DB
+    if (!listed) {
+      for (wrk = g_list_first(list); wrk; wrk = g_list_next(wrk)) {
+	object = wrk->data;
+	child = make_child(dir, object->name);
+	if (!child->obj[NODE_DB])
+	  set_node_obj(child, NODE_DB, object);
+	else
+	  free_ms_obj(object);
+      }
+      dir->listed = g_get_monotonic_time();
+    }
+
+    // объекты директории из кэша DB, если их нет в кэше APP
+    if (dir->children != NULL) {
+      gboolean masks = (g_hash_table_size(cache.mask_table) > 0);
+      GHashTableIter iter;
+      gpointer key, value;
+      g_hash_table_iter_init(&iter, dir->children);
+      while (g_hash_table_iter_next(&iter, &key, &value)) {
+	child = (struct sqlfs_node *) value;
+	if (!child->obj[NODE_DB] || child->obj[NODE_APP])
+	  continue;
+
+	if (masks) {
+	  gchar *str = (nschema)
+	    ? g_strjoin(G_DIR_SEPARATOR_S, pathdir, child->name, NULL)
+	    : g_strconcat(pathdir, child->name, NULL);
+	  gboolean masked = is_masked(str);
+	  g_free(str);
+
+	  if (masked)
+	    continue;
 	}
-	reslist = g_list_append(reslist, ms2sqlfs(object));
+
+	reslist = g_list_prepend(reslist, ms2sqlfs(child->obj[NODE_DB]));
       }
-      g_free(str);
-      wrk = g_list_next(wrk);
     }
-    g_list_free(wrk);
 
     // дополнить список объектов из APP кэша
-    GHashTableIter iter;
-    gpointer key, value;
-    g_mutex_lock(&cache.m);
-    g_hash_table_iter_init(&iter, cache.app_table);
-    while (g_hash_table_iter_next(&iter, &key, &value)) {
-      gchar *keydir = g_path_get_dirname(key);
-      if (!g_strcmp0(keydir, pathdir)) {
-	object = (struct sqlfs_ms_obj *) value;
-	reslist = g_list_append(reslist, ms2sqlfs(object));
+    if (dir->pending != NULL) {
+      GHashTableIter iter;
+      gpointer key, value;
+      g_hash_table_iter_init(&iter, dir->pending);
+      while (g_hash_table_iter_next(&iter, &key, &value)) {
+	child = (struct sqlfs_node *) key;
+	if (child->obj[NODE_APP]) {
+	  reslist = g_list_append(reslist, ms2sqlfs(child->obj[NODE_APP]));
+	}
       }
-      g_free(keydir);
     }
     g_mutex_unlock(&cache.m);
 
   }
+  else {
+    g_list_free_full(list, free_ms_obj);
+    list = NULL;
+  }
+
+  g_list_free(list);
   
-  continue_timer(paused);
+  continue_deploy(paused);
   
   if (terr != NULL)
     g_propagate_error(error, terr);
@@ -1026,32 +2572,46 @@ char * fetch_object_text(const char *path, GError **error)
   char *text = NULL;
   GError *terr = NULL;
   
-  // отключаем таймер деплоя на время выборки из БД
-  gboolean paused = pause_timer();
+  // сброс не начнётся во время выборки из БД
+  gboolean paused = pause_deploy();
   
   struct sqlfs_ms_obj *object = find_cache_obj(path, &terr);
 
   if (terr == NULL) {
     gchar **schema = g_strsplit(g_path_skip_root(path), G_DIR_SEPARATOR_S, -1);
 
-    if (!is_masked(path) && !is_temp(object)
-	&& !g_hash_table_contains(cache.app_table, path)) {
-      text = load_module_text(*schema, object, &terr);
+    g_mutex_lock(&cache.m);
+    gboolean in_app = (lookup_tree(cache.root, path, NODE_APP) != NULL);
+    g_mutex_unlock(&cache.m);
+
+    if (!is_masked(path) && !is_temp(object) && !in_app) {
+      // текст не изменившегося модуля берётся из кэша
+      text = get_text(object);
+      if (text == NULL) {
+	text = load_module_text(*schema, object, &terr);
 
-      if (object->def != NULL)
-	g_free(object->def);
-      
-      object->def = text;
-      object->len = strlen(object->def);
+	if (terr == NULL && (IS_SCHOBJ(object) || object->type == R_TR))
+	  put_text(object, text);
+      }
+
+      // текст объекта кэша принадлежит кэшу, вызывающий получает копию
+      if (text != NULL) {
+	gchar *copy = g_strdup(text);
+	set_def(object, text);
+	text = copy;
+      }
     }
     else {
-      text = object->def;
+      g_mutex_lock(&cache.m);
+      text = g_strdup(object->def);
+      g_mutex_unlock(&cache.m);
     }
     
     g_strfreev(schema); 
   }
 
-  continue_timer(paused);
+  free_ms_obj(object);
+  continue_deploy(paused);
   
   if (terr != NULL)
     g_propagate_error(error, terr);
@@ -1096,7 +2656,11 @@ void create_dir(const char *pathdir, GError **error)
       obj->name = g_path_get_basename(pathdir);
       obj->object_id = 0;
 
-      g_hash_table_insert(cache.app_table, g_strdup(pathdir), obj);
+      drop_negative(pathdir);
+
+      g_mutex_lock(&cache.m);
+      insert_tree(cache.root, pathdir, NODE_APP, obj);
+      g_mutex_unlock(&cache.m);
       cmd->sql = g_strdup(sql->str);
       crep_object(pathdir, cmd, obj);
     } else {
@@ -1134,7 +2698,11 @@ void create_node(const char *pathfile, GError **error)
     tobj->type = R_TEMP;
     tobj->def = g_strdup("\0");
 
-    g_hash_table_insert(cache.app_table, g_strdup(pathfile), tobj);
+    drop_negative(pathfile);
+
+    g_mutex_lock(&cache.m);
+    insert_tree(cache.root, pathfile, NODE_APP, tobj);
+    g_mutex_unlock(&cache.m);
     crep_object(pathfile, cmd, tobj);
 
     end_cache();
@@ -1166,19 +2734,27 @@ void write_object(const char *path, const char *buffer, GError **error)
 
     if (terr != NULL) {
       g_clear_error(&terr);
-      object->name = g_path_get_basename(path);
+
+      if (object != NULL) {
+	g_mutex_lock(&cache.m);
+	g_free(object->name);
+	object->name = g_path_get_basename(path);
+	g_mutex_unlock(&cache.m);
+      }
     }
 
     if (object && buffer && strlen(buffer) > 0) {
-      object->object_id = get_mask_id(path);
+      int object_id = get_mask_id(path);
+
+      // разбор текста меняет тип и описание объекта, доступного читателям
+      g_mutex_lock(&cache.m);
+      object->object_id = object_id;
       char *sql = write_ms_object(*schema, pobj, buffer, object, &terr);
-      if (terr == NULL && sql != NULL) {
+      g_mutex_unlock(&cache.m);
 
-	if (object->def != NULL)
-	  g_free(object->def);
+      if (terr == NULL && sql != NULL) {
 
-	object->def = g_strdup(buffer);
-	object->len = strlen(object->def);
+	set_def(object, g_strdup(buffer));
 	cmd->sql = sql;
 	crep_object(path, cmd, object);
       }
@@ -1194,6 +2770,8 @@ void write_object(const char *path, const char *buffer, GError **error)
 
     end_cache();
 
+    free_ms_obj(pobj);
+    free_ms_obj(object);
     g_free(pp);
   }
 
@@ -1210,46 +2788,55 @@ void truncate_object(const char *path, off_t offset, GError **error)
   GError *terr = NULL;
 
   struct sqlcmd *cmd = start_cache();
-  struct sqlfs_ms_obj *obj = g_hash_table_lookup(cache.app_table, path);
+
+  g_mutex_lock(&cache.m);
+  struct sqlfs_ms_obj *obj = ref_ms_obj(lookup_tree(cache.root, path,
+						    NODE_APP));
+  g_mutex_unlock(&cache.m);
+
+  gboolean in_app = (obj != NULL);
   if (!obj) {
     obj = find_cache_obj(path, &terr);
     if (terr == NULL) {
-      g_hash_table_steal(cache.db_table, path);
+      g_mutex_lock(&cache.m);
+      free_ms_obj(steal_tree(cache.root, path, NODE_DB));
+      g_mutex_unlock(&cache.m);
     }
   }
 
   if (obj != NULL && terr == NULL) {
     gchar **schema = g_strsplit(g_path_skip_root(path), G_DIR_SEPARATOR_S, -1);
     char *def = NULL;
-    if (obj->object_id != 0 && !g_hash_table_contains(cache.app_table, path)) {
+    if (obj->object_id != 0 && !in_app) {
       char *load = load_module_text(*schema, obj, &terr);
       def = g_strndup(load, offset);
       g_free(load);
     }
-    else
-      if (obj->def != NULL) {
+    else {
+      g_mutex_lock(&cache.m);
+      if (obj->def != NULL)
 	def = g_strndup(obj->def, offset);
-      }
+      g_mutex_unlock(&cache.m);
+    }
 
+    // уже прочитанный текст заменяется пустым
     if (obj->def != NULL) {
-      g_free(obj->def);
+      g_free(def);
       def = NULL;
     }
 
     if (offset > 0 && def != NULL) {
-      obj->def = def;
-      obj->len = strlen(obj->def);
-      
-      cmd->sql = g_strdup(obj->def);
+      cmd->sql = g_strdup(def);
+      set_def(obj, def);
       crep_object(path, cmd, obj);
     }
-    else {
-      obj->def = g_strdup("\0");
-      obj->len = 0;
-    }
+    else
+      set_def(obj, g_strdup("\0"));
 
-    if (!g_hash_table_contains(cache.app_table, path)) {
-      g_hash_table_insert(cache.app_table, g_strdup(path), obj);
+    if (!in_app) {
+      g_mutex_lock(&cache.m);
+      insert_tree(cache.root, path, NODE_APP, ref_ms_obj(obj));
+      g_mutex_unlock(&cache.m);
     }
 
     if (g_strv_length(schema) > 0) {
@@ -1263,6 +2850,8 @@ void truncate_object(const char *path, off_t offset, GError **error)
   
   end_cache();
 
+  free_ms_obj(obj);
+
   if (terr != NULL)
     g_propagate_error(error, terr);
 }
@@ -1288,11 +2877,10 @@ void remove_object(const char *path, GError **error)
     }
 
     // очистить файлы директории из кэша
-    if (IS_DIR(object)) {
-      char *p = g_strdup(path);
-      g_hash_table_foreach_remove(cache.app_table, &clear_tbl_files, p);
-      g_hash_table_foreach_remove(cache.db_table, &clear_tbl_files, p);
-      g_free(p);
+    if (object != NULL && IS_DIR(object)) {
+      g_mutex_lock(&cache.m);
+      remove_node_dir(find_node(cache.root, path));
+      g_mutex_unlock(&cache.m);
     }
     
     SAFE_REMOVE_ALL(path);
@@ -1301,6 +2889,8 @@ void remove_object(const char *path, GError **error)
       free_sqlcmd_object(cmd);
     
     end_cache();
+
+    free_ms_obj(object);
   }
 
   if (g_strv_length(schema) > 0) {
@@ -1342,14 +2932,22 @@ void rename_object(const char *oldname, const char *newname, GError **error)
 
   if (terr == NULL) {
     lock_cache();
+
+    drop_negative(newname);
     
     gboolean is_exists = FALSE;
-    struct sqlfs_ms_obj *obj_new = g_hash_table_lookup(cache.app_table, newname);
+    struct sqlfs_ms_obj *stolen = NULL;
+
+    g_mutex_lock(&cache.m);
+    struct sqlfs_ms_obj *obj_new = lookup_tree(cache.root, newname, NODE_APP);
     
     if (obj_new == NULL)
-      obj_new = g_hash_table_lookup(cache.db_table, newname);
-    else
-      is_exists = g_hash_table_steal(cache.app_table, newname);
+      obj_new = ref_ms_obj(lookup_tree(cache.root, newname, NODE_DB));
+    else {
+      stolen = steal_tree(cache.root, newname, NODE_APP);
+      is_exists = (stolen != NULL);
+    }
+    g_mutex_unlock(&cache.m);
     
     if (obj_new == NULL) {
 
@@ -1364,8 +2962,13 @@ void rename_object(const char *oldname, const char *newname, GError **error)
       
     }
     else
-      if (!is_exists)
-	is_exists = g_hash_table_steal(cache.db_table, newname);
+      if (!is_exists) {
+	g_mutex_lock(&cache.m);
+	stolen = steal_tree(cache.root, newname, NODE_DB);
+	g_mutex_unlock(&cache.m);
+	is_exists = (stolen != NULL);
+	free_ms_obj(stolen);
+      }
 
     struct sqlfs_ms_obj *obj_old = find_cache_obj(oldname, &terr);
     if (obj_new != NULL) {
@@ -1391,24 +2994,20 @@ void rename_object(const char *oldname, const char *newname, GError **error)
       struct sqlfs_ms_obj
 	*ppobj_old = find_cache_obj(ppold, &terr);
 
-      gboolean allocated = FALSE;
       if (obj_new == NULL) {
 	obj_new = g_try_new0(struct sqlfs_ms_obj, 1);
 	obj_new->name = g_path_get_basename(newname);
-	allocated = TRUE;
       }
 
+      g_mutex_lock(&cache.m);
+      gboolean in_db = (lookup_tree(cache.root, oldname, NODE_DB) != NULL);
+      g_mutex_unlock(&cache.m);
+
       // для старого объекта ещё не был прочитан текст
-      if (g_hash_table_contains(cache.db_table, oldname) && !obj_old->def
-	  && IS_REG(obj_old)) {
+      if (in_db && !obj_old->def && IS_REG(obj_old)) {
 	char *def = load_module_text(*schemaold, obj_old, &terr);
-	if (terr == NULL) {
-	  if (obj_old->def != NULL)
-	    g_free(obj_old->def);
-
-	  obj_old->def = def;
-	  obj_old->len = strlen(def);
-	}
+	if (terr == NULL)
+	  set_def(obj_old, def);
       }
 
       struct sqlcmd *cmd = g_try_new0(struct sqlcmd, 1);
@@ -1421,27 +3020,27 @@ void rename_object(const char *oldname, const char *newname, GError **error)
 	rename_obj(oldname, newname, cmd, obj_old);
       }
 
+      free_ms_obj(ppobj_old);
       g_free(ppold);
-
-      if (obj_new != NULL && allocated)
-	free_ms_obj(obj_new);
     }
     
     // переименование в кэше
     if (terr == NULL) {
-      if (g_hash_table_contains(cache.app_table, oldname))
-	g_hash_table_steal(cache.app_table, oldname);
-      
-      if (g_hash_table_contains(cache.db_table, oldname))
-	g_hash_table_steal(cache.db_table, oldname);
+      g_mutex_lock(&cache.m);
+      free_ms_obj(steal_tree(cache.root, oldname, NODE_APP));
+      free_ms_obj(steal_tree(cache.root, oldname, NODE_DB));
 
       g_free(obj_old->name);
       obj_old->name = g_path_get_basename(newname);
       
-      g_hash_table_insert(cache.app_table, g_strdup(newname), obj_old);
+      insert_tree(cache.root, newname, NODE_APP, ref_ms_obj(obj_old));
+      g_mutex_unlock(&cache.m);
     }
 
     end_cache();
+
+    free_ms_obj(obj_new);
+    free_ms_obj(obj_old);
   }
   
   g_strfreev(schemanew);
@@ -1512,6 +3111,8 @@ GList * fetch_listxattr(const char *path, GError **error)
     }
     
   }
+
+  free_ms_obj(object);
   
   if (terr != NULL)
     g_propagate_error(error, terr);
@@ -1562,6 +3163,8 @@ char * fetch_xattr(const char *path, const char *name, GError **error)
     }
 
   }
+
+  free_ms_obj(object);
   
   if (terr != NULL)
     g_propagate_error(error, terr);
@@ -1605,19 +3208,49 @@ void destroy_cache(GError **error)
   g_mutex_unlock(&deploy.lock);
 
   g_thread_join(deploy.thread);
+
+  if (hot.thread != NULL) {
+    hot.run = 0;
+    g_thread_join(hot.thread);
+  }
+
+  if (watch.thread != NULL) {
+    g_mutex_lock(&watch.lock);
+    watch.run = 0;
+    g_cond_signal(&watch.cond);
+    g_mutex_unlock(&watch.lock);
+
+    g_thread_join(watch.thread);
+  }
   
+  if (get_context()->snapshot)
+    save_cache_snapshot();
+
   close_msctx(&terr);
   
-  g_hash_table_destroy(cache.db_table);
-  g_hash_table_destroy(cache.app_table);
+  free_tree(cache.root);
   g_hash_table_destroy(cache.mask_table);
+  g_hash_table_destroy(cache.neg_table);
+  g_queue_free(cache.neg_queue);
+  g_hash_table_destroy(cache.text_table);
+  g_queue_free(cache.text_queue);
   
+  g_hash_table_destroy(deploy.path_index);
+  g_hash_table_destroy(deploy.dir_index);
   g_sequence_free(deploy.sql_seq);
-  g_timer_destroy(deploy.timer);
   
   g_mutex_clear(&cache.m);
   g_mutex_clear(&deploy.lock);
   g_cond_clear(&deploy.cond);
+  g_cond_clear(&deploy.done_cond);
+
+  g_hash_table_destroy(hot.changed);
+
+  g_hash_table_destroy(watch.stat_table);
+  if (watch.mdate != NULL)
+    g_free(watch.mdate);
+  g_mutex_clear(&watch.lock);
+  g_cond_clear(&watch.cond);
   
   
   if (terr != NULL)
@@ -0,0 +1,233 @@
+/*
+  Copyright (C) 2013, 2014 Movsunov A.N.
+
+  This file is part of SQLFuse
+
+  SQLFuse is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SQLFuse is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SQLFuse.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <conf/keyconf.h>
+
+#include "snapshot.h"
+
+#include <errno.h>
+#include <string.h>
+
+#define SNAPSHOT_MAGIC "SQLFSNAP"
+#define SNAPSHOT_ORDER 0x01020304
+
+/*
+ * Заголовок файла, следом строка источника "сервер/БД" и записи
+ */
+struct snap_header {
+  char magic[8];
+  guint32 version;
+  guint32 order;
+  guint32 count;
+  guint32 source_len;
+};
+
+/*
+ * Запись объекта, следом путь и текст определения
+ */
+struct snap_record {
+  guint32 type;
+  gint32 object_id, parent_id, schema_id;
+  gint64 ctime, mtime;
+  guint32 len;
+  guint32 path_len, def_len;
+};
+
+struct snapshot {
+  GByteArray *data;
+  guint32 count;
+};
+
+static gchar * snapshot_file(const char *profile)
+{
+  return g_build_filename(g_get_user_cache_dir(), "sqlfuse", profile,
+			  "snapshot", NULL);
+}
+
+static gchar * snapshot_source()
+{
+  sqlctx_t *sqlctx = get_context();
+
+  return g_strconcat(sqlctx->servername, G_DIR_SEPARATOR_S,
+		     sqlctx->dbname, NULL);
+}
+
+snapshot_t * new_snapshot()
+{
+  snapshot_t *snap = g_try_new0(snapshot_t, 1);
+  snap->data = g_byte_array_new();
+
+  struct snap_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.order = SNAPSHOT_ORDER;
+
+  gchar *source = snapshot_source();
+  header.source_len = strlen(source);
+
+  g_byte_array_append(snap->data, (guint8 *) &header, sizeof(header));
+  g_byte_array_append(snap->data, (guint8 *) source, header.source_len);
+  g_free(source);
+
+  return snap;
+}
+
+void add_snapshot(snapshot_t *snap, const char *path, struct sqlfs_ms_obj *obj)
+{
+  struct snap_record rec;
+  memset(&rec, 0, sizeof(rec));
+
+  rec.type = obj->type;
+  rec.object_id = obj->object_id;
+  rec.parent_id = obj->parent_id;
+  rec.schema_id = obj->schema_id;
+  rec.ctime = obj->ctime;
+  rec.mtime = obj->mtime;
+  rec.len = obj->len;
+  rec.path_len = strlen(path);
+  rec.def_len = (obj->def) ? strlen(obj->def) : 0;
+
+  g_byte_array_append(snap->data, (guint8 *) &rec, sizeof(rec));
+  g_byte_array_append(snap->data, (guint8 *) path, rec.path_len);
+  if (rec.def_len > 0)
+    g_byte_array_append(snap->data, (guint8 *) obj->def, rec.def_len);
+
+  snap->count++;
+}
+
+void save_snapshot(snapshot_t *snap, const char *profile, GError **error)
+{
+  GError *terr = NULL;
+  gchar *filename = snapshot_file(profile);
+  gchar *dirname = g_path_get_dirname(filename);
+
+  // число записей известно только в конце
+  struct snap_header *header = (struct snap_header *) snap->data->data;
+  header->count = snap->count;
+
+  if (g_mkdir_with_parents(dirname, 0700) != 0) {
+    g_set_error(&terr, G_FILE_ERROR, g_file_error_from_errno(errno),
+		"%d: Unable create %s\n", __LINE__, dirname);
+  }
+  else
+    g_file_set_contents(filename, (gchar *) snap->data->data,
+			snap->data->len, &terr);
+
+  g_free(dirname);
+  g_free(filename);
+
+  g_byte_array_free(snap->data, TRUE);
+  g_free(snap);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+}
+
+GList * load_snapshot(const char *profile, GError **error)
+{
+  GList *list = NULL;
+  GError *terr = NULL;
+  gchar *filename = snapshot_file(profile);
+
+  if (!g_file_test(filename, G_FILE_TEST_IS_REGULAR)) {
+    g_free(filename);
+    return NULL;
+  }
+
+  GMappedFile *file = g_mapped_file_new(filename, FALSE, &terr);
+  g_free(filename);
+
+  if (terr == NULL) {
+    const gchar *pos = g_mapped_file_get_contents(file);
+    const gchar *end = pos + g_mapped_file_get_length(file);
+    gchar *source = snapshot_source();
+    gboolean valid = FALSE;
+    struct snap_header header;
+
+    if (end - pos >= sizeof(header)) {
+      memcpy(&header, pos, sizeof(header));
+      pos += sizeof(header);
+
+      valid = (!memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic))
+	       && header.version == SNAPSHOT_VERSION
+	       && header.order == SNAPSHOT_ORDER
+	       && header.source_len == strlen(source)
+	       && end - pos >= header.source_len
+	       && !memcmp(pos, source, header.source_len));
+    }
+    g_free(source);
+
+    if (valid) {
+      pos += header.source_len;
+
+      guint32 i;
+      struct snap_record rec;
+      for (i = 0; valid && i < header.count; i++) {
+	if (end - pos < sizeof(rec)) {
+	  valid = FALSE;
+	  break;
+	}
+
+	memcpy(&rec, pos, sizeof(rec));
+	pos += sizeof(rec);
+
+	if (end - pos < (gint64) rec.path_len + rec.def_len) {
+	  valid = FALSE;
+	  break;
+	}
+
+	struct sqlfs_ms_obj *obj = g_try_new0(struct sqlfs_ms_obj, 1);
+	obj->name = g_strndup(pos, rec.path_len);
+	pos += rec.path_len;
+
+	if (rec.def_len > 0) {
+	  obj->def = g_strndup(pos, rec.def_len);
+	  pos += rec.def_len;
+	}
+
+	obj->type = rec.type;
+	obj->object_id = rec.object_id;
+	obj->parent_id = rec.parent_id;
+	obj->schema_id = rec.schema_id;
+	obj->ctime = rec.ctime;
+	obj->mtime = rec.mtime;
+	obj->len = rec.len;
+
+	list = g_list_prepend(list, obj);
+      }
+
+      // повреждённый снимок не используется
+      if (!valid) {
+	g_list_free_full(list, free_ms_obj);
+	list = NULL;
+
+	g_set_error(&terr, EEPARSE, EEPARSE,
+		    "%d: Snapshot is corrupted\n", __LINE__);
+      }
+    }
+
+    g_mapped_file_unref(file);
+  }
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+
+  return g_list_reverse(list);
+}
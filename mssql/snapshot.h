@@ -0,0 +1,53 @@
+/*
+  Copyright (C) 2013, 2014 Movsunov A.N.
+
+  This file is part of SQLFuse
+
+  SQLFuse is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SQLFuse is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SQLFuse.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSSNAPSHOT_H
+#define MSSNAPSHOT_H
+
+#include "msctx.h"
+
+// при изменении формата файла снимка версия увеличивается
+#define SNAPSHOT_VERSION 1
+
+typedef struct snapshot snapshot_t;
+
+
+/*
+ * Начать новый снимок DB-кэша
+ */
+snapshot_t * new_snapshot();
+
+/*
+ * Добавить объект в снимок
+ */
+void add_snapshot(snapshot_t *snap, const char *path,
+		  struct sqlfs_ms_obj *obj);
+
+/*
+ * Записать снимок профиля на диск и освободить его
+ */
+void save_snapshot(snapshot_t *snap, const char *profile, GError **error);
+
+/*
+ * Загрузить снимок профиля. Вернёт список объектов, в name - полный путь.
+ * Снимок другой версии или другой БД не загружается.
+ */
+GList * load_snapshot(const char *profile, GError **error);
+
+#endif
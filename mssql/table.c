@@ -136,17 +136,13 @@ char * make_column_def(struct sqlfs_ms_obj *obj)
   return text;
 }
 
-GList * fetch_columns(int tid, const char *name, msctx_t *ctx, GError **error)
+static void make_columns_sql(GString *sql, int tid, const char *name)
 {
-  GError *terr = NULL;
-  GList *reslist = NULL;
-  GString *sql = g_string_new(NULL);
-
   if (!tid)
     g_string_append(sql, "SELECT stab.dir_path + '/' + sc.name");
   else
     g_string_append(sql, "SELECT sc.name");
-  
+
   g_string_append(sql, ", sc.column_id, sc.system_type_id, sc.max_length");
   g_string_append(sql, ", sc.precision, sc.scale, sc.is_nullable");
   g_string_append(sql, ", sc.is_ansi_padded, sc.is_identity, st.name");
@@ -165,91 +161,90 @@ GList * fetch_columns(int tid, const char *name, msctx_t *ctx, GError **error)
   }
   else {
     g_string_append_printf(sql, " WHERE sc.object_id = %d", tid);
-    
+
     if (name)
       g_string_append_printf(sql, " AND sc.name = '%s'", name);
   }
+}
 
-  exec_sql_cmd(sql->str, ctx, &terr);
+static GList * read_columns(int tid, msctx_t *ctx, GError **error)
+{
+  GList *reslist = NULL;
+  GError *terr = NULL;
 
-  if (!terr) {
-    DBINT col_id_buf, type_id_buf, mlen, precision, scale, nullable,
-      ansi, identity, not4repl, obj_parent_id;
-    char *colname_buf = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
-    char *typename_buf = g_malloc0_n(dbcollen(ctx->dbproc, 10) + 1, sizeof(char ));
-    char *seed_val = g_malloc0_n(dbcollen(ctx->dbproc, 11) + 1, sizeof(char ));
-    char *inc_val = g_malloc0_n(dbcollen(ctx->dbproc, 12) + 1, sizeof(char ));
-
-    dbbind(ctx->dbproc, 1, STRINGBIND,
-	   dbcollen(ctx->dbproc, 1), (BYTE *) colname_buf);
-    dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &col_id_buf);
-    dbbind(ctx->dbproc, 3, INTBIND, (DBINT) 0, (BYTE *) &type_id_buf);
-    dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &mlen);
-    dbbind(ctx->dbproc, 5, INTBIND, (DBINT) 0, (BYTE *) &precision);
-    dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &scale);
-    dbbind(ctx->dbproc, 7, INTBIND, (DBINT) 0, (BYTE *) &nullable);
-    dbbind(ctx->dbproc, 8, INTBIND, (DBINT) 0, (BYTE *) &ansi);
-    dbbind(ctx->dbproc, 9, INTBIND, (DBINT) 0, (BYTE *) &identity);
-    dbbind(ctx->dbproc, 10, STRINGBIND,
-	   dbcollen(ctx->dbproc, 10), (BYTE *) typename_buf);
-    dbbind(ctx->dbproc, 11, STRINGBIND,
-	   dbcollen(ctx->dbproc, 11), (BYTE *) seed_val);
-    dbbind(ctx->dbproc, 12, STRINGBIND,
-	   dbcollen(ctx->dbproc, 12), (BYTE *) inc_val);
-    dbbind(ctx->dbproc, 13, INTBIND, (DBINT) 0, (BYTE *) &not4repl);
-    dbbind(ctx->dbproc, 14, INTBIND, (DBINT) 0, (BYTE *) &obj_parent_id);
-  
-    int rowcode;
-    while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
-      switch(rowcode) {
-      case REG_ROW: {
-	struct sqlfs_ms_obj *obj = g_try_new0(struct sqlfs_ms_obj, 1);
-	
-	obj->object_id = obj_parent_id;
-	obj->name = g_strdup(g_strchomp(colname_buf));
-	obj->type = R_COL;
-	obj->parent_id = tid;
-	
-	obj->column = g_try_new0(struct sqlfs_ms_column, 1);     
-	obj->column->column_id = col_id_buf;
-	obj->column->systype = type_id_buf;
-	obj->column->max_len = mlen;
-	obj->column->identity = identity;
-	obj->column->scale = scale;
-	obj->column->precision = precision;
-	obj->column->nullable = nullable;
-	obj->column->ansi = ansi;
-	obj->column->type_name = g_strdup(g_strchomp(typename_buf));
-	if (identity == TRUE) {
-	  obj->column->seed_val = g_strdup(g_strchomp(seed_val));
-	  obj->column->inc_val = g_strdup(g_strchomp(inc_val));
-	  obj->column->not4repl = not4repl;
-	}
-	obj->def = make_column_def(obj);
-	obj->len = strlen(obj->def);	
-      
-	reslist = g_list_append(reslist, obj);
-      }
-	break;
-      case BUF_FULL:
-	g_set_error(&terr, EEFULL, EEFULL,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
-      case FAIL:
-	g_set_error(&terr, EERES, EERES,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
+  DBINT col_id_buf, type_id_buf, mlen, precision, scale, nullable,
+    ansi, identity, not4repl, obj_parent_id;
+  char *colname_buf = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
+  char *typename_buf = g_malloc0_n(dbcollen(ctx->dbproc, 10) + 1, sizeof(char ));
+  char *seed_val = g_malloc0_n(dbcollen(ctx->dbproc, 11) + 1, sizeof(char ));
+  char *inc_val = g_malloc0_n(dbcollen(ctx->dbproc, 12) + 1, sizeof(char ));
+
+  dbbind(ctx->dbproc, 1, STRINGBIND,
+	 dbcollen(ctx->dbproc, 1), (BYTE *) colname_buf);
+  dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &col_id_buf);
+  dbbind(ctx->dbproc, 3, INTBIND, (DBINT) 0, (BYTE *) &type_id_buf);
+  dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &mlen);
+  dbbind(ctx->dbproc, 5, INTBIND, (DBINT) 0, (BYTE *) &precision);
+  dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &scale);
+  dbbind(ctx->dbproc, 7, INTBIND, (DBINT) 0, (BYTE *) &nullable);
+  dbbind(ctx->dbproc, 8, INTBIND, (DBINT) 0, (BYTE *) &ansi);
+  dbbind(ctx->dbproc, 9, INTBIND, (DBINT) 0, (BYTE *) &identity);
+  dbbind(ctx->dbproc, 10, STRINGBIND,
+	 dbcollen(ctx->dbproc, 10), (BYTE *) typename_buf);
+  dbbind(ctx->dbproc, 11, STRINGBIND,
+	 dbcollen(ctx->dbproc, 11), (BYTE *) seed_val);
+  dbbind(ctx->dbproc, 12, STRINGBIND,
+	 dbcollen(ctx->dbproc, 12), (BYTE *) inc_val);
+  dbbind(ctx->dbproc, 13, INTBIND, (DBINT) 0, (BYTE *) &not4repl);
+  dbbind(ctx->dbproc, 14, INTBIND, (DBINT) 0, (BYTE *) &obj_parent_id);
+
+  int rowcode;
+  while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
+    switch(rowcode) {
+    case REG_ROW: {
+      struct sqlfs_ms_obj *obj = g_try_new0(struct sqlfs_ms_obj, 1);
+
+      obj->object_id = obj_parent_id;
+      obj->name = g_strdup(g_strchomp(colname_buf));
+      obj->type = R_COL;
+      obj->parent_id = tid;
+
+      obj->column = g_try_new0(struct sqlfs_ms_column, 1);     
+      obj->column->column_id = col_id_buf;
+      obj->column->systype = type_id_buf;
+      obj->column->max_len = mlen;
+      obj->column->identity = identity;
+      obj->column->scale = scale;
+      obj->column->precision = precision;
+      obj->column->nullable = nullable;
+      obj->column->ansi = ansi;
+      obj->column->type_name = g_strdup(g_strchomp(typename_buf));
+      if (identity == TRUE) {
+	obj->column->seed_val = g_strdup(g_strchomp(seed_val));
+	obj->column->inc_val = g_strdup(g_strchomp(inc_val));
+	obj->column->not4repl = not4repl;
       }
+      obj->def = make_column_def(obj);
+      obj->len = strlen(obj->def);	
+
+      reslist = g_list_append(reslist, obj);
+    }
+      break;
+    case BUF_FULL:
+      g_set_error(&terr, EEFULL, EEFULL,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
+    case FAIL:
+      g_set_error(&terr, EERES, EERES,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
     }
-    
-    g_free(typename_buf);
-    g_free(colname_buf);
-    g_free(seed_val);
-    g_free(inc_val);
-  
   }
 
-  g_string_free(sql, TRUE);
+  g_free(typename_buf);
+  g_free(colname_buf);
+  g_free(seed_val);
+  g_free(inc_val);
 
   if (terr != NULL)
     g_propagate_error(error, terr);
@@ -257,17 +252,33 @@ GList * fetch_columns(int tid, const char *name, msctx_t *ctx, GError **error)
   return reslist;
 }
 
-GList * fetch_modules(int tid, const char *name, msctx_t *ctx, GError **error)
+GList * fetch_columns(int tid, const char *name, msctx_t *ctx, GError **error)
 {
+  GList *reslist = NULL;
   GError *terr = NULL;
-  GList *list = NULL;
   GString *sql = g_string_new(NULL);
 
+  make_columns_sql(sql, tid, name);
+  exec_sql_cmd(sql->str, ctx, &terr);
+
+  if (!terr)
+    reslist = read_columns(tid, ctx, &terr);
+
+  g_string_free(sql, TRUE);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+
+  return reslist;
+}
+
+static void make_modules_sql(GString *sql, int tid, const char *name)
+{
   if (!tid)
     g_string_append(sql, "SELECT stab.dir_path + '/' + so.name");
   else
     g_string_append(sql, "SELECT so.name");
-  
+
   g_string_append(sql, ", so.object_id, so.type");
   g_string_append(sql, ", DATEDIFF(second, {d '1970-01-01'}, so.create_date)");
   g_string_append(sql, ", DATEDIFF(second, {d '1970-01-01'}, so.modify_date)");
@@ -283,72 +294,91 @@ GList * fetch_modules(int tid, const char *name, msctx_t *ctx, GError **error)
   }
   else {
     g_string_append_printf(sql, " WHERE so.parent_object_id = %d", tid);
-    
+
     if (name)
       g_string_append_printf(sql, " AND so.name = '%s'", name);
   }
-  
-  exec_sql_cmd(sql->str, ctx, &terr);
-  
-  if (!terr) {
-    DBINT trg_id_buf;
-    DBCHAR type_buf[2];
-    DBINT def_len_buf;
-    char *trgname_buf = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
-    DBINT cdate_buf, mdate_buf, is_disabled;
-
-    dbbind(ctx->dbproc, 1, STRINGBIND,
-	   dbcollen(ctx->dbproc, 1), (BYTE *) trgname_buf);
-    dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &trg_id_buf);
-    dbbind(ctx->dbproc, 3, STRINGBIND, (DBINT) 0, (BYTE *) type_buf);
-    dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &cdate_buf);
-    dbbind(ctx->dbproc, 5, INTBIND, (DBINT) 0, (BYTE *) &mdate_buf);
-    dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &def_len_buf);
-    dbbind(ctx->dbproc, 7, INTBIND, (DBINT) 0, (BYTE *) &is_disabled);
-  
-    int rowcode;
-    struct sqlfs_ms_obj * trgobj = NULL;
-  
-    while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
-      switch(rowcode) {
-      case REG_ROW:
-	trgname_buf = g_strchomp(trgname_buf);
-	char *typen = g_strndup(type_buf, 2);
-	trgobj = g_try_new0(struct sqlfs_ms_obj, 1);
-	
-	trgobj->object_id = trg_id_buf;
-	trgobj->name = g_strdup(trgname_buf);
-	trgobj->type = str2mstype(g_strchomp(typen));
-	trgobj->parent_id = tid;
-	trgobj->ctime = cdate_buf;
-	trgobj->mtime = mdate_buf;
-	trgobj->len = def_len_buf;
-	trgobj->is_disabled = is_disabled;
-
-	g_free(typen);
-
-	list = g_list_append(list, trgobj);
-	break;
-      case BUF_FULL:
-	g_set_error(&terr, EEFULL, EEFULL,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
-      case FAIL:
-	g_set_error(&terr, EERES, EERES,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
-      }
+}
+
+static GList * read_modules(int tid, msctx_t *ctx, GError **error)
+{
+  GList *list = NULL;
+  GError *terr = NULL;
+
+  DBINT trg_id_buf;
+  DBCHAR type_buf[2];
+  DBINT def_len_buf;
+  char *trgname_buf = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
+  DBINT cdate_buf, mdate_buf, is_disabled;
+
+  dbbind(ctx->dbproc, 1, STRINGBIND,
+	 dbcollen(ctx->dbproc, 1), (BYTE *) trgname_buf);
+  dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &trg_id_buf);
+  dbbind(ctx->dbproc, 3, STRINGBIND, (DBINT) 0, (BYTE *) type_buf);
+  dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &cdate_buf);
+  dbbind(ctx->dbproc, 5, INTBIND, (DBINT) 0, (BYTE *) &mdate_buf);
+  dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &def_len_buf);
+  dbbind(ctx->dbproc, 7, INTBIND, (DBINT) 0, (BYTE *) &is_disabled);
+
+  int rowcode;
+  struct sqlfs_ms_obj * trgobj = NULL;
+
+  while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
+    switch(rowcode) {
+    case REG_ROW:
+      trgname_buf = g_strchomp(trgname_buf);
+      char *typen = g_strndup(type_buf, 2);
+      trgobj = g_try_new0(struct sqlfs_ms_obj, 1);
+
+      trgobj->object_id = trg_id_buf;
+      trgobj->name = g_strdup(trgname_buf);
+      trgobj->type = str2mstype(g_strchomp(typen));
+      trgobj->parent_id = tid;
+      trgobj->ctime = cdate_buf;
+      trgobj->mtime = mdate_buf;
+      trgobj->len = def_len_buf;
+      trgobj->is_disabled = is_disabled;
+
+      g_free(typen);
+
+      list = g_list_append(list, trgobj);
+      break;
+    case BUF_FULL:
+      g_set_error(&terr, EEFULL, EEFULL,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
+    case FAIL:
+      g_set_error(&terr, EERES, EERES,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
     }
-    
-    g_free(trgname_buf);
-    
   }
 
+  g_free(trgname_buf);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+
+  return list;
+}
+
+GList * fetch_modules(int tid, const char *name, msctx_t *ctx, GError **error)
+{
+  GList *list = NULL;
+  GError *terr = NULL;
+  GString *sql = g_string_new(NULL);
+
+  make_modules_sql(sql, tid, name);
+  exec_sql_cmd(sql->str, ctx, &terr);
+
+  if (!terr)
+    list = read_modules(tid, ctx, &terr);
+
   g_string_free(sql, TRUE);
 
   if (terr != NULL)
     g_propagate_error(error, terr);
-  
+
   return list;
 }
 
@@ -387,18 +417,13 @@ char * make_constraint_def(struct sqlfs_ms_obj *ctrt, const char *def)
   return text;
 }
 
-GList * fetch_constraints(int tid, const char *name, msctx_t *ctx, GError **error)
+static void make_constraints_sql(GString *sql, int tid, const char *name)
 {
-  GList *reslist = NULL;
-
-  GError *terr = NULL;
-  GString *sql = g_string_new(NULL);
-
   if (!tid)
     g_string_append(sql, "SELECT ss.dir_path + '/' + dc.name");
   else
     g_string_append(sql, "SELECT dc.name");
-  
+
   g_string_append(sql, ", dc.object_id, sc.name");
   g_string_append(sql, ", dc.definition, dc.type, 0, 0");
   g_string_append(sql, ", DATEDIFF(second, {d '1970-01-01'}, dc.create_date)");
@@ -417,10 +442,10 @@ GList * fetch_constraints(int tid, const char *name, msctx_t *ctx, GError **erro
   }
   else {
     g_string_append_printf(sql, "WHERE dc.parent_object_id = %d", tid);
-    
+
     if (name != NULL)
       g_string_append_printf(sql, " AND dc.name = '%s'", name);
-    
+
     g_string_append(sql, " UNION ALL ");
     g_string_append(sql, "SELECT cc.name");    
   }
@@ -438,87 +463,106 @@ GList * fetch_constraints(int tid, const char *name, msctx_t *ctx, GError **erro
   }
   else {
     g_string_append_printf(sql, "WHERE cc.parent_object_id = %d", tid);
-    
+
     if (name != NULL)
       g_string_append_printf(sql, "AND cc.name = '%s'", name);
   }
+}
 
-  exec_sql_cmd(sql->str, ctx, &terr);
-  
-  if (terr == NULL) {
-    DBINT obj_id;
-    DBCHAR type_buf[2];
-    DBINT cdate_buf, mdate_buf, disabled, not4repl;
-    char *csnt_name = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
-    char *clmn_name = g_malloc0_n(dbcollen(ctx->dbproc, 3) + 1, sizeof(char ));
-    char *def_text  = g_malloc0_n(dbcollen(ctx->dbproc, 4) + 1, sizeof(char ));
-
-    dbbind(ctx->dbproc, 1, STRINGBIND,
-	   dbcollen(ctx->dbproc, 1), (BYTE *) csnt_name);
-    dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &obj_id);
-    dbbind(ctx->dbproc, 3, STRINGBIND,
-	   dbcollen(ctx->dbproc, 3), (BYTE *) clmn_name);
-    dbbind(ctx->dbproc, 4, STRINGBIND,
-	   dbcollen(ctx->dbproc, 4), (BYTE *) def_text);
-    dbbind(ctx->dbproc, 5, STRINGBIND, (DBINT) 0, (BYTE *) type_buf);
-    dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &disabled);
-    dbbind(ctx->dbproc, 7, INTBIND, (DBINT) 0, (BYTE *) &not4repl);
-    dbbind(ctx->dbproc, 8, INTBIND, (DBINT) 0, (BYTE *) &cdate_buf);
-    dbbind(ctx->dbproc, 9, INTBIND, (DBINT) 0, (BYTE *) &mdate_buf);
-
-    int rowcode;
-    struct sqlfs_ms_obj *obj = NULL;
-    
-    while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
-      switch(rowcode) {
-      case REG_ROW:
-	obj = g_try_new0(struct sqlfs_ms_obj, 1);
-	char *typen = g_strndup(type_buf, 2);
-	obj->object_id = obj_id;
-	obj->parent_id = tid;
-	obj->name = g_strdup(g_strchomp(csnt_name));
-	obj->mtime = mdate_buf;
-	obj->ctime = cdate_buf;
-	obj->type = str2mstype(g_strchomp(typen));
-
-	obj->clmn_ctrt =  g_try_new0(struct sqlfs_ms_constraint, 1);
-
-	if (obj->type == R_D)
-	  obj->clmn_ctrt->column_name = g_strdup(g_strchomp(clmn_name));
-	else {
-	  obj->clmn_ctrt->disabled = disabled;
-	  obj->clmn_ctrt->not4repl = not4repl;
-	}
-	
-	obj->def = make_constraint_def(obj, g_strchomp(def_text));
-	obj->len = strlen(obj->def);
-
-	g_free(typen);
-
-	reslist = g_list_append(reslist, obj);
-	break;
-      case BUF_FULL:
-	g_set_error(&terr, EEFULL, EEFULL,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
-      case FAIL:
-	g_set_error(&terr, EERES, EERES,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
+static GList * read_constraints(int tid, msctx_t *ctx, GError **error)
+{
+  GList *reslist = NULL;
+  GError *terr = NULL;
+
+  DBINT obj_id;
+  DBCHAR type_buf[2];
+  DBINT cdate_buf, mdate_buf, disabled, not4repl;
+  char *csnt_name = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
+  char *clmn_name = g_malloc0_n(dbcollen(ctx->dbproc, 3) + 1, sizeof(char ));
+  char *def_text  = g_malloc0_n(dbcollen(ctx->dbproc, 4) + 1, sizeof(char ));
+
+  dbbind(ctx->dbproc, 1, STRINGBIND,
+	 dbcollen(ctx->dbproc, 1), (BYTE *) csnt_name);
+  dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &obj_id);
+  dbbind(ctx->dbproc, 3, STRINGBIND,
+	 dbcollen(ctx->dbproc, 3), (BYTE *) clmn_name);
+  dbbind(ctx->dbproc, 4, STRINGBIND,
+	 dbcollen(ctx->dbproc, 4), (BYTE *) def_text);
+  dbbind(ctx->dbproc, 5, STRINGBIND, (DBINT) 0, (BYTE *) type_buf);
+  dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &disabled);
+  dbbind(ctx->dbproc, 7, INTBIND, (DBINT) 0, (BYTE *) &not4repl);
+  dbbind(ctx->dbproc, 8, INTBIND, (DBINT) 0, (BYTE *) &cdate_buf);
+  dbbind(ctx->dbproc, 9, INTBIND, (DBINT) 0, (BYTE *) &mdate_buf);
+
+  int rowcode;
+  struct sqlfs_ms_obj *obj = NULL;
+
+  while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
+    switch(rowcode) {
+    case REG_ROW:
+      obj = g_try_new0(struct sqlfs_ms_obj, 1);
+      char *typen = g_strndup(type_buf, 2);
+      obj->object_id = obj_id;
+      obj->parent_id = tid;
+      obj->name = g_strdup(g_strchomp(csnt_name));
+      obj->mtime = mdate_buf;
+      obj->ctime = cdate_buf;
+      obj->type = str2mstype(g_strchomp(typen));
+
+      obj->clmn_ctrt =  g_try_new0(struct sqlfs_ms_constraint, 1);
+
+      if (obj->type == R_D)
+	obj->clmn_ctrt->column_name = g_strdup(g_strchomp(clmn_name));
+      else {
+	obj->clmn_ctrt->disabled = disabled;
+	obj->clmn_ctrt->not4repl = not4repl;
       }
-    }
 
-    g_free(csnt_name);
-    g_free(clmn_name);
-    g_free(def_text);
-    
+      obj->def = make_constraint_def(obj, g_strchomp(def_text));
+      obj->len = strlen(obj->def);
+
+      g_free(typen);
+
+      reslist = g_list_append(reslist, obj);
+      break;
+    case BUF_FULL:
+      g_set_error(&terr, EEFULL, EEFULL,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
+    case FAIL:
+      g_set_error(&terr, EERES, EERES,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
+    }
   }
 
+  g_free(csnt_name);
+  g_free(clmn_name);
+  g_free(def_text);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+
+  return reslist;
+}
+
+GList * fetch_constraints(int tid, const char *name, msctx_t *ctx, GError **error)
+{
+  GList *reslist = NULL;
+  GError *terr = NULL;
+  GString *sql = g_string_new(NULL);
+
+  make_constraints_sql(sql, tid, name);
+  exec_sql_cmd(sql->str, ctx, &terr);
+
+  if (!terr)
+    reslist = read_constraints(tid, ctx, &terr);
+
   g_string_free(sql, TRUE);
 
   if (terr != NULL)
     g_propagate_error(error, terr);
-  
+
   return reslist;
 }
 
@@ -603,17 +647,13 @@ char * make_foreign_def(struct sqlfs_ms_obj *obj)
   return text;
 }
 
-GList * fetch_foreignes(int tid, const char *name, msctx_t *ctx, GError **error)
+static void make_foreignes_sql(GString *sql, int tid, const char *name)
 {
-  GList *reslist = NULL;
-  GError *terr = NULL;
-  GString *sql = g_string_new(NULL);
-
   if (!tid)
     g_string_append(sql, "SELECT sj.dir_path + '/' + fk.name");
   else
     g_string_append(sql, "SELECT fk.name");
-    
+
   g_string_append(sql, ", fk.object_id, fk.is_disabled");
   g_string_append(sql, ", fk.is_not_for_replication");
   g_string_append(sql, ", fk.delete_referential_action");
@@ -633,7 +673,7 @@ GList * fetch_foreignes(int tid, const char *name, msctx_t *ctx, GError **error)
   g_string_append(sql, "       AND sc_ref.object_id = fkc.referenced_object_id");
   g_string_append(sql, "    WHERE fkc.constraint_object_id = fk.object_id");
   g_string_append(sql, "    FOR XML PATH(''), TYPE).value('.', 'NVARCHAR(MAX)'))");
-  
+
   g_string_append(sql, ", SCHEMA_NAME(so_ref.schema_id), so_ref.name");
   g_string_append(sql, ", DATEDIFF(second, {d '1970-01-01'}, fk.create_date)");
   g_string_append(sql, ", DATEDIFF(second, {d '1970-01-01'}, fk.modify_date)");
@@ -646,104 +686,123 @@ GList * fetch_foreignes(int tid, const char *name, msctx_t *ctx, GError **error)
   }
   else {
     g_string_append_printf(sql, " WHERE fk.parent_object_id = %d", tid);
-    
+
     if (name)
       g_string_append_printf(sql, " AND fk.name = '%s'", name);
   }
+}
 
-  exec_sql_cmd(sql->str, ctx, &terr);
-  if (!terr) {
-    DBINT obj_id, is_not4repl, delact, updact, mdate, cdate, disabled;
-    char *name_def = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
-    char *own_def = g_malloc0_n(dbcollen(ctx->dbproc, 7) + 1, sizeof(char ));
-    char *ref_def = g_malloc0_n(dbcollen(ctx->dbproc, 8) + 1, sizeof(char ));
-    char *schema_name = g_malloc0_n(dbcollen(ctx->dbproc, 9) + 1, sizeof(char ));
-    char *ref_name = g_malloc0_n(dbcollen(ctx->dbproc, 10) + 1, sizeof(char ));
-
-    dbbind(ctx->dbproc, 1, STRINGBIND,
-	   dbcollen(ctx->dbproc, 1), (BYTE *) name_def);
-    dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &obj_id);
-    dbbind(ctx->dbproc, 3, INTBIND, (DBINT) 0, (BYTE *) &disabled);
-    dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &is_not4repl);
-    dbbind(ctx->dbproc, 5, INTBIND, (DBINT) 0, (BYTE *) &delact);
-    dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &updact);
-    dbbind(ctx->dbproc, 7, STRINGBIND,
-	   dbcollen(ctx->dbproc, 7), (BYTE *) own_def);
-    dbbind(ctx->dbproc, 8, STRINGBIND,
-	   dbcollen(ctx->dbproc, 8), (BYTE *) ref_def);
-    dbbind(ctx->dbproc, 9, STRINGBIND,
-	   dbcollen(ctx->dbproc, 9), (BYTE *) schema_name);
-    dbbind(ctx->dbproc, 10, STRINGBIND,
-	   dbcollen(ctx->dbproc, 10), (BYTE *) ref_name);
-    dbbind(ctx->dbproc, 11, INTBIND, (DBINT) 0, (BYTE *) &cdate);
-    dbbind(ctx->dbproc, 12, INTBIND, (DBINT) 0, (BYTE *) &mdate);
-
-    int rowcode;
-    while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
-      switch(rowcode) {
-      case REG_ROW: {
-	struct sqlfs_ms_obj *obj = g_try_new0(struct sqlfs_ms_obj, 1);
-	obj->object_id = obj_id;
-	obj->parent_id = tid;
-	obj->name = g_strdup(g_strchomp(name_def));
-	obj->mtime = mdate;
-	obj->ctime = cdate;
-	obj->type = R_F;
-
-	struct sqlfs_ms_fk *fk = g_try_new0(struct sqlfs_ms_fk, 1);
-	fk->delact = delact;
-	fk->updact = updact;
-	fk->not4repl = is_not4repl;
-	fk->disabled = disabled;
-	
-	char *wstr = NULL;
-	if (own_def) {
-	  wstr = g_strchomp(own_def);
-	  fk->columns_def = g_strndup(wstr, strlen(wstr) - 1);
-	}
-	
-	schema_name = g_strchomp(schema_name);
-	ref_name = g_strchomp(ref_name);
-	fk->ref_object_def = g_strconcat("[", schema_name, "].[",
-					 ref_name, "]", NULL);
-	if (ref_def) {
-	  wstr = g_strchomp(ref_def);
-	  fk->ref_columns_def = g_strndup(ref_def, strlen(wstr) - 1);
-	}
-
-	obj->foreign_ctrt = fk;
-	obj->def = make_foreign_def(obj);
-	obj->len = strlen(obj->def);
-
-	reslist = g_list_append(reslist, obj);
+static GList * read_foreignes(int tid, msctx_t *ctx, GError **error)
+{
+  GList *reslist = NULL;
+  GError *terr = NULL;
+
+  DBINT obj_id, is_not4repl, delact, updact, mdate, cdate, disabled;
+  char *name_def = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
+  char *own_def = g_malloc0_n(dbcollen(ctx->dbproc, 7) + 1, sizeof(char ));
+  char *ref_def = g_malloc0_n(dbcollen(ctx->dbproc, 8) + 1, sizeof(char ));
+  char *schema_name = g_malloc0_n(dbcollen(ctx->dbproc, 9) + 1, sizeof(char ));
+  char *ref_name = g_malloc0_n(dbcollen(ctx->dbproc, 10) + 1, sizeof(char ));
+
+  dbbind(ctx->dbproc, 1, STRINGBIND,
+	 dbcollen(ctx->dbproc, 1), (BYTE *) name_def);
+  dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &obj_id);
+  dbbind(ctx->dbproc, 3, INTBIND, (DBINT) 0, (BYTE *) &disabled);
+  dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &is_not4repl);
+  dbbind(ctx->dbproc, 5, INTBIND, (DBINT) 0, (BYTE *) &delact);
+  dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &updact);
+  dbbind(ctx->dbproc, 7, STRINGBIND,
+	 dbcollen(ctx->dbproc, 7), (BYTE *) own_def);
+  dbbind(ctx->dbproc, 8, STRINGBIND,
+	 dbcollen(ctx->dbproc, 8), (BYTE *) ref_def);
+  dbbind(ctx->dbproc, 9, STRINGBIND,
+	 dbcollen(ctx->dbproc, 9), (BYTE *) schema_name);
+  dbbind(ctx->dbproc, 10, STRINGBIND,
+	 dbcollen(ctx->dbproc, 10), (BYTE *) ref_name);
+  dbbind(ctx->dbproc, 11, INTBIND, (DBINT) 0, (BYTE *) &cdate);
+  dbbind(ctx->dbproc, 12, INTBIND, (DBINT) 0, (BYTE *) &mdate);
+
+  int rowcode;
+  while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
+    switch(rowcode) {
+    case REG_ROW: {
+      struct sqlfs_ms_obj *obj = g_try_new0(struct sqlfs_ms_obj, 1);
+      obj->object_id = obj_id;
+      obj->parent_id = tid;
+      obj->name = g_strdup(g_strchomp(name_def));
+      obj->mtime = mdate;
+      obj->ctime = cdate;
+      obj->type = R_F;
+
+      struct sqlfs_ms_fk *fk = g_try_new0(struct sqlfs_ms_fk, 1);
+      fk->delact = delact;
+      fk->updact = updact;
+      fk->not4repl = is_not4repl;
+      fk->disabled = disabled;
+
+      char *wstr = NULL;
+      if (own_def) {
+	wstr = g_strchomp(own_def);
+	fk->columns_def = g_strndup(wstr, strlen(wstr) - 1);
       }
-	break;
-      case BUF_FULL:
-	g_set_error(&terr, EEFULL, EEFULL,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
-      case FAIL:
-	g_set_error(&terr, EERES, EERES,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
+
+      schema_name = g_strchomp(schema_name);
+      ref_name = g_strchomp(ref_name);
+      fk->ref_object_def = g_strconcat("[", schema_name, "].[",
+				       ref_name, "]", NULL);
+      if (ref_def) {
+	wstr = g_strchomp(ref_def);
+	fk->ref_columns_def = g_strndup(ref_def, strlen(wstr) - 1);
       }
+
+      obj->foreign_ctrt = fk;
+      obj->def = make_foreign_def(obj);
+      obj->len = strlen(obj->def);
+
+      reslist = g_list_append(reslist, obj);
+    }
+      break;
+    case BUF_FULL:
+      g_set_error(&terr, EEFULL, EEFULL,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
+    case FAIL:
+      g_set_error(&terr, EERES, EERES,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
     }
-    
-    g_free(name_def);
-    g_free(own_def);
-    g_free(ref_def);
-    g_free(schema_name);
-    g_free(ref_name);
-    
   }
 
+  g_free(name_def);
+  g_free(own_def);
+  g_free(ref_def);
+  g_free(schema_name);
+  g_free(ref_name);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+
+  return reslist;
+}
+
+GList * fetch_foreignes(int tid, const char *name, msctx_t *ctx, GError **error)
+{
+  GList *reslist = NULL;
+  GError *terr = NULL;
+  GString *sql = g_string_new(NULL);
+
+  make_foreignes_sql(sql, tid, name);
+  exec_sql_cmd(sql->str, ctx, &terr);
+
+  if (!terr)
+    reslist = read_foreignes(tid, ctx, &terr);
+
   g_string_free(sql, TRUE);
-  
+
   if (terr != NULL)
     g_propagate_error(error, terr);
-  
+
   return reslist;
-  
 }
 
 char * create_index_def(const char *schema, const char *table,
@@ -850,12 +909,8 @@ char * make_index_def(const char *schema, const char *table,
   return text;
 }
 
-GList * fetch_indexes(int tid, const char *name, msctx_t *ctx, GError **error)
+static void make_indexes_sql(GString *sql, int tid, const char *name)
 {
-  GList *reslist = NULL;
-  GError *terr = NULL;
-  GString *sql = g_string_new(NULL);
-
   if (!tid)
     g_string_append(sql, "SELECT sj.dir_path + '/' + si.name");
   else
@@ -892,7 +947,7 @@ GList * fetch_indexes(int tid, const char *name, msctx_t *ctx, GError **error)
   g_string_append(sql, "   FOR XML PATH(''), TYPE).value('.', 'NVARCHAR(MAX)') )");
 
   g_string_append(sql, ", ds.name, SCHEMA_NAME(so.schema_id), so.name");
-  
+
   g_string_append(sql, " FROM sys.objects so INNER JOIN sys.indexes si");
   g_string_append(sql, "   ON si.object_id = so.object_id");
   g_string_append(sql, " INNER JOIN sys.data_spaces ds");
@@ -902,145 +957,215 @@ GList * fetch_indexes(int tid, const char *name, msctx_t *ctx, GError **error)
     g_string_append(sql, "INNER JOIN #sch_objs sj");
     g_string_append(sql, " ON sj.obj_id = so.object_id\n");
   }
-  
+
   g_string_append(sql, " WHERE si.type <> 0");
 
   if (tid) {
     g_string_append_printf(sql, "AND so.object_id = %d", tid);
-    
+
     if (name)
       g_string_append_printf(sql, " AND si.name = '%s'", name);
   }
+}
 
-  exec_sql_cmd(sql->str, ctx, &terr);
-  if (!terr) {
-    DBINT obj_id, index_id, type_id, is_unique, ignr_dup_key, is_pk, is_uqc;
-    DBCHAR type_buf[2];
-    char *name_buf = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
-    char *filter_def = g_malloc0_n(dbcollen(ctx->dbproc, 19) + 1, sizeof(char ));
-    char *col_def = g_malloc0_n(dbcollen(ctx->dbproc, 20) + 1, sizeof(char ));
-    char *incl_def = g_malloc0_n(dbcollen(ctx->dbproc, 21) + 1, sizeof(char ));
-    char *data_space = g_malloc0_n(dbcollen(ctx->dbproc, 22) + 1, sizeof(char ));
-    char *schema_name = g_malloc0_n(dbcollen(ctx->dbproc, 23) + 1, sizeof(char ));
-    char *table_name = g_malloc0_n(dbcollen(ctx->dbproc, 24) + 1, sizeof(char ));
-    DBINT cdate_buf, mdate_buf, fill_factor, is_padded, is_disabled, is_hyp;
-    DBINT allow_rl, allow_pl, has_filter;
-
-    dbbind(ctx->dbproc, 1, STRINGBIND,
-	   dbcollen(ctx->dbproc, 1), (BYTE *) name_buf);
-    dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &obj_id);
-    dbbind(ctx->dbproc, 3, STRINGBIND, (DBINT) 0, (BYTE *) type_buf);
-    dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &cdate_buf);
-    dbbind(ctx->dbproc, 5, INTBIND, (DBINT) 0, (BYTE *) &mdate_buf);
-    dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &index_id);
-    dbbind(ctx->dbproc, 7, INTBIND, (DBINT) 0, (BYTE *) &type_id);
-    dbbind(ctx->dbproc, 8, INTBIND, (DBINT) 0, (BYTE *) &is_unique);
-    dbbind(ctx->dbproc, 9, INTBIND, (DBINT) 0, (BYTE *) &ignr_dup_key);
-    dbbind(ctx->dbproc, 10, INTBIND, (DBINT) 0, (BYTE *) &is_pk);
-    dbbind(ctx->dbproc, 11, INTBIND, (DBINT) 0, (BYTE *) &is_uqc);
-    dbbind(ctx->dbproc, 12, INTBIND, (DBINT) 0, (BYTE *) &fill_factor);
-    dbbind(ctx->dbproc, 13, INTBIND, (DBINT) 0, (BYTE *) &is_padded);
-    dbbind(ctx->dbproc, 14, INTBIND, (DBINT) 0, (BYTE *) &is_disabled);
-    dbbind(ctx->dbproc, 15, INTBIND, (DBINT) 0, (BYTE *) &is_hyp);
-    dbbind(ctx->dbproc, 16, INTBIND, (DBINT) 0, (BYTE *) &allow_rl);
-    dbbind(ctx->dbproc, 17, INTBIND, (DBINT) 0, (BYTE *) &allow_pl);
-    dbbind(ctx->dbproc, 18, INTBIND, (DBINT) 0, (BYTE *) &has_filter);
-    dbbind(ctx->dbproc, 19, STRINGBIND,
-	   dbcollen(ctx->dbproc, 19), (BYTE *) filter_def);
-    dbbind(ctx->dbproc, 20, STRINGBIND,
-	   dbcollen(ctx->dbproc, 20), (BYTE *) col_def);
-    dbbind(ctx->dbproc, 21, STRINGBIND,
-	   dbcollen(ctx->dbproc, 21), (BYTE *) incl_def);
-    dbbind(ctx->dbproc, 22, STRINGBIND,
-	   dbcollen(ctx->dbproc, 22), (BYTE *) data_space);
-    dbbind(ctx->dbproc, 23, STRINGBIND,
-	   dbcollen(ctx->dbproc, 23), (BYTE *) schema_name);
-    dbbind(ctx->dbproc, 24, STRINGBIND,
-	   dbcollen(ctx->dbproc, 24), (BYTE *) table_name);
-  
-    int rowcode;
-    struct sqlfs_ms_obj *obj = NULL;
-    char *wstr = NULL;
-    while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
-      switch(rowcode) {
-      case REG_ROW:
-	obj = g_try_new0(struct sqlfs_ms_obj, 1);
-	obj->object_id = index_id;
-	obj->parent_id = obj_id;
-	obj->name = g_strdup(g_strchomp(name_buf));
-	obj->mtime = mdate_buf;
-	obj->ctime = cdate_buf;
-	
-	if (is_pk == TRUE)
-	  obj->type = R_PK;
+static GList * read_indexes(int tid, msctx_t *ctx, GError **error)
+{
+  GList *reslist = NULL;
+  GError *terr = NULL;
+
+  DBINT obj_id, index_id, type_id, is_unique, ignr_dup_key, is_pk, is_uqc;
+  DBCHAR type_buf[2];
+  char *name_buf = g_malloc0_n(dbcollen(ctx->dbproc, 1) + 1, sizeof(char ));
+  char *filter_def = g_malloc0_n(dbcollen(ctx->dbproc, 19) + 1, sizeof(char ));
+  char *col_def = g_malloc0_n(dbcollen(ctx->dbproc, 20) + 1, sizeof(char ));
+  char *incl_def = g_malloc0_n(dbcollen(ctx->dbproc, 21) + 1, sizeof(char ));
+  char *data_space = g_malloc0_n(dbcollen(ctx->dbproc, 22) + 1, sizeof(char ));
+  char *schema_name = g_malloc0_n(dbcollen(ctx->dbproc, 23) + 1, sizeof(char ));
+  char *table_name = g_malloc0_n(dbcollen(ctx->dbproc, 24) + 1, sizeof(char ));
+  DBINT cdate_buf, mdate_buf, fill_factor, is_padded, is_disabled, is_hyp;
+  DBINT allow_rl, allow_pl, has_filter;
+
+  dbbind(ctx->dbproc, 1, STRINGBIND,
+	 dbcollen(ctx->dbproc, 1), (BYTE *) name_buf);
+  dbbind(ctx->dbproc, 2, INTBIND, (DBINT) 0, (BYTE *) &obj_id);
+  dbbind(ctx->dbproc, 3, STRINGBIND, (DBINT) 0, (BYTE *) type_buf);
+  dbbind(ctx->dbproc, 4, INTBIND, (DBINT) 0, (BYTE *) &cdate_buf);
+  dbbind(ctx->dbproc, 5, INTBIND, (DBINT) 0, (BYTE *) &mdate_buf);
+  dbbind(ctx->dbproc, 6, INTBIND, (DBINT) 0, (BYTE *) &index_id);
+  dbbind(ctx->dbproc, 7, INTBIND, (DBINT) 0, (BYTE *) &type_id);
+  dbbind(ctx->dbproc, 8, INTBIND, (DBINT) 0, (BYTE *) &is_unique);
+  dbbind(ctx->dbproc, 9, INTBIND, (DBINT) 0, (BYTE *) &ignr_dup_key);
+  dbbind(ctx->dbproc, 10, INTBIND, (DBINT) 0, (BYTE *) &is_pk);
+  dbbind(ctx->dbproc, 11, INTBIND, (DBINT) 0, (BYTE *) &is_uqc);
+  dbbind(ctx->dbproc, 12, INTBIND, (DBINT) 0, (BYTE *) &fill_factor);
+  dbbind(ctx->dbproc, 13, INTBIND, (DBINT) 0, (BYTE *) &is_padded);
+  dbbind(ctx->dbproc, 14, INTBIND, (DBINT) 0, (BYTE *) &is_disabled);
+  dbbind(ctx->dbproc, 15, INTBIND, (DBINT) 0, (BYTE *) &is_hyp);
+  dbbind(ctx->dbproc, 16, INTBIND, (DBINT) 0, (BYTE *) &allow_rl);
+  dbbind(ctx->dbproc, 17, INTBIND, (DBINT) 0, (BYTE *) &allow_pl);
+  dbbind(ctx->dbproc, 18, INTBIND, (DBINT) 0, (BYTE *) &has_filter);
+  dbbind(ctx->dbproc, 19, STRINGBIND,
+	 dbcollen(ctx->dbproc, 19), (BYTE *) filter_def);
+  dbbind(ctx->dbproc, 20, STRINGBIND,
+	 dbcollen(ctx->dbproc, 20), (BYTE *) col_def);
+  dbbind(ctx->dbproc, 21, STRINGBIND,
+	 dbcollen(ctx->dbproc, 21), (BYTE *) incl_def);
+  dbbind(ctx->dbproc, 22, STRINGBIND,
+	 dbcollen(ctx->dbproc, 22), (BYTE *) data_space);
+  dbbind(ctx->dbproc, 23, STRINGBIND,
+	 dbcollen(ctx->dbproc, 23), (BYTE *) schema_name);
+  dbbind(ctx->dbproc, 24, STRINGBIND,
+	 dbcollen(ctx->dbproc, 24), (BYTE *) table_name);
+
+  int rowcode;
+  struct sqlfs_ms_obj *obj = NULL;
+  char *wstr = NULL;
+  while (!terr && (rowcode = dbnextrow(ctx->dbproc)) != NO_MORE_ROWS) {
+    switch(rowcode) {
+    case REG_ROW:
+      obj = g_try_new0(struct sqlfs_ms_obj, 1);
+      obj->object_id = index_id;
+      obj->parent_id = obj_id;
+      obj->name = g_strdup(g_strchomp(name_buf));
+      obj->mtime = mdate_buf;
+      obj->ctime = cdate_buf;
+
+      if (is_pk == TRUE)
+	obj->type = R_PK;
+      else
+	if (is_uqc == TRUE)
+	  obj->type = R_UQ;
 	else
-	  if (is_uqc == TRUE)
-	    obj->type = R_UQ;
-	  else
-	    obj->type = R_X;
-
-	struct sqlfs_ms_index *idx = g_try_new0(struct sqlfs_ms_index, 1);
-	idx->type_id = type_id;
-	idx->is_unique = is_unique;
-	idx->ignore_dup_key = ignr_dup_key;
-	idx->is_pk = is_pk;
-	idx->is_unique_const = is_uqc;
-	idx->fill_factor = fill_factor;
-	idx->is_padded = is_padded;
-	idx->is_disabled = is_disabled;
-	idx->is_hyp = is_hyp;
-	idx->allow_rl = allow_rl;
-	idx->allow_pl = allow_pl;
-	idx->has_filter = has_filter;
-
-	if (has_filter)
-	  idx->filter_def = g_strdup(g_strchomp(filter_def));
-	
-	if (col_def != NULL) {
-	  wstr = g_strchomp(col_def);
-	  if (strlen(wstr) > 0)
-	    idx->columns_def = g_strndup(wstr, strlen(wstr) - 1);
-	}
-
-	if (incl_def != NULL) {
-	  wstr = g_strchomp(incl_def);
-	  if (strlen(wstr) > 0)
-	    idx->incl_columns_def = g_strndup(wstr, strlen(wstr) - 1);
-	}
-
-	if (data_space)
-	  idx->data_space = g_strdup(g_strchomp(data_space));
-	
-	obj->index = idx;
-	obj->def = make_index_def(g_strchomp(schema_name),
-				  g_strchomp(table_name), obj);
-	obj->len = strlen(obj->def);
-	reslist = g_list_append(reslist, obj);
-	break;
-      case BUF_FULL:
-	g_set_error(&terr, EEFULL, EEFULL,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
-      case FAIL:
-	g_set_error(&terr, EERES, EERES,
-		    "%d: dbresults failed\n", __LINE__);
-	break;
+	  obj->type = R_X;
+
+      struct sqlfs_ms_index *idx = g_try_new0(struct sqlfs_ms_index, 1);
+      idx->type_id = type_id;
+      idx->is_unique = is_unique;
+      idx->ignore_dup_key = ignr_dup_key;
+      idx->is_pk = is_pk;
+      idx->is_unique_const = is_uqc;
+      idx->fill_factor = fill_factor;
+      idx->is_padded = is_padded;
+      idx->is_disabled = is_disabled;
+      idx->is_hyp = is_hyp;
+      idx->allow_rl = allow_rl;
+      idx->allow_pl = allow_pl;
+      idx->has_filter = has_filter;
+
+      if (has_filter)
+	idx->filter_def = g_strdup(g_strchomp(filter_def));
+
+      if (col_def != NULL) {
+	wstr = g_strchomp(col_def);
+	if (strlen(wstr) > 0)
+	  idx->columns_def = g_strndup(wstr, strlen(wstr) - 1);
       }
+
+      if (incl_def != NULL) {
+	wstr = g_strchomp(incl_def);
+	if (strlen(wstr) > 0)
+	  idx->incl_columns_def = g_strndup(wstr, strlen(wstr) - 1);
+      }
+
+      if (data_space)
+	idx->data_space = g_strdup(g_strchomp(data_space));
+
+      obj->index = idx;
+      obj->def = make_index_def(g_strchomp(schema_name),
+				g_strchomp(table_name), obj);
+      obj->len = strlen(obj->def);
+      reslist = g_list_append(reslist, obj);
+      break;
+    case BUF_FULL:
+      g_set_error(&terr, EEFULL, EEFULL,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
+    case FAIL:
+      g_set_error(&terr, EERES, EERES,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
     }
+  }
+
+  g_free(data_space);
+  g_free(name_buf);
+  g_free(filter_def);
+  g_free(col_def);
+  g_free(incl_def);
+  g_free(schema_name);
+  g_free(table_name);
+
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+
+  return reslist;
+}
+
+GList * fetch_indexes(int tid, const char *name, msctx_t *ctx, GError **error)
+{
+  GList *reslist = NULL;
+  GError *terr = NULL;
+  GString *sql = g_string_new(NULL);
+
+  make_indexes_sql(sql, tid, name);
+  exec_sql_cmd(sql->str, ctx, &terr);
+
+  if (!terr)
+    reslist = read_indexes(tid, ctx, &terr);
+
+  g_string_free(sql, TRUE);
 
-    g_free(data_space);
-    g_free(name_buf);
-    g_free(filter_def);
-    g_free(col_def);
-    g_free(incl_def);
-    g_free(schema_name);
-    g_free(table_name);
+  if (terr != NULL)
+    g_propagate_error(error, terr);
+
+  return reslist;
+}
+
+typedef GList * (*read_fn)(int tid, msctx_t *ctx, GError **error);
+
+GList * fetch_table_batch(int tid, const char *name, msctx_t *ctx,
+			  GError **error)
+{
+  GList *reslist = NULL;
+  GError *terr = NULL;
+  GString *sql = g_string_new(NULL);
+
+  // порядок запросов пакета совпадает с порядком чтения результатов
+  read_fn readers[] = { read_columns, read_indexes, read_modules,
+			read_foreignes, read_constraints };
+
+  make_columns_sql(sql, tid, name);
+  g_string_append(sql, "\n");
+  make_indexes_sql(sql, tid, name);
+  g_string_append(sql, "\n");
+  make_modules_sql(sql, tid, name);
+  g_string_append(sql, "\n");
+  make_foreignes_sql(sql, tid, name);
+  g_string_append(sql, "\n");
+  make_constraints_sql(sql, tid, name);
+
+  exec_sql_cmd(sql->str, ctx, &terr);
+
+  int i;
+  for (i = 0; !terr && i < G_N_ELEMENTS(readers); i++) {
+    // следующий набор результатов пакета
+    if (i > 0 && dbresults(ctx->dbproc) != SUCCEED) {
+      g_set_error(&terr, EERES, EERES,
+		  "%d: dbresults failed\n", __LINE__);
+      break;
+    }
+
+    reslist = g_list_concat(reslist, readers[i](tid, ctx, &terr));
   }
-  
+
+  // не оставлять непрочитанных результатов в подключении
+  if (terr != NULL)
+    dbcancel(ctx->dbproc);
+
   g_string_free(sql, TRUE);
 
   if (terr != NULL)
     g_propagate_error(error, terr);
-  
+
   return reslist;
 }
@@ -98,4 +98,10 @@ GList * fetch_constraints(int table_id, const char *name, msctx_t *ctx,
 GList * fetch_foreignes(int table_id, const char *name, msctx_t *ctx,
 			GError **err);
 
+/*
+ * Вернёт все объекты таблицы %table_id одним пакетом запросов
+ */
+GList * fetch_table_batch(int table_id, const char *name, msctx_t *ctx,
+			  GError **err);
+
 #endif
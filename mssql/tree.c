@@ -0,0 +1,364 @@
+/*
+  Copyright (C) 2013, 2014 Movsunov A.N.
+
+  This file is part of SQLFuse
+
+  SQLFuse is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SQLFuse is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SQLFuse.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tree.h"
+
+#include <string.h>
+
+static void free_node(gpointer data)
+{
+  if (!data)
+    return ;
+
+  struct sqlfs_node *node = (struct sqlfs_node *) data;
+
+  if (node->pending != NULL)
+    g_hash_table_destroy(node->pending);
+
+  if (node->children != NULL)
+    g_hash_table_destroy(node->children);
+
+  if (node->obj[NODE_DB] != NULL)
+    free_ms_obj(node->obj[NODE_DB]);
+
+  if (node->obj[NODE_APP] != NULL)
+    free_ms_obj(node->obj[NODE_APP]);
+
+  if (node->name != NULL)
+    g_free(node->name);
+
+  g_free(node);
+}
+
+static inline gboolean has_pending(struct sqlfs_node *node)
+{
+  return (node->obj[NODE_APP] != NULL
+	  || (node->pending != NULL && g_hash_table_size(node->pending) > 0));
+}
+
+/*
+ * Поддержать индекс pending от узла до корня
+ */
+static void update_pending(struct sqlfs_node *node)
+{
+  while (node->parent != NULL) {
+    struct sqlfs_node *parent = node->parent;
+
+    if (has_pending(node)) {
+      if (!parent->pending)
+	parent->pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+      // предки уже проиндексированы
+      if (g_hash_table_contains(parent->pending, node))
+	break;
+
+      g_hash_table_add(parent->pending, node);
+    }
+    else {
+      if (!parent->pending || !g_hash_table_remove(parent->pending, node))
+	break;
+    }
+
+    node = parent;
+  }
+}
+
+static inline gboolean is_empty(struct sqlfs_node *node)
+{
+  return (node->obj[NODE_DB] == NULL && node->obj[NODE_APP] == NULL
+	  && (node->children == NULL || g_hash_table_size(node->children) == 0)
+	  && (node->pending == NULL || g_hash_table_size(node->pending) == 0));
+}
+
+static gboolean is_empty_child(gpointer key, gpointer value,
+			       gpointer user_data)
+{
+  return is_empty((struct sqlfs_node *) value);
+}
+
+/*
+ * Удалить пустой узел и ставших пустыми предков, корень остаётся
+ */
+static void prune_node(struct sqlfs_node *node)
+{
+  while (node->parent != NULL && is_empty(node)) {
+    struct sqlfs_node *parent = node->parent;
+    g_hash_table_remove(parent->children, node->name);
+    node = parent;
+  }
+}
+
+/*
+ * Удалить пустые дочерние узлы после обхода директории
+ */
+static inline void prune_children(struct sqlfs_node *node)
+{
+  if (node->children != NULL)
+    g_hash_table_foreach_remove(node->children, &is_empty_child, NULL);
+}
+
+static inline void expire_parent(struct sqlfs_node *node)
+{
+  if (node->parent != NULL)
+    node->parent->listed = 0;
+}
+
+static void clear_pending(struct sqlfs_node *node)
+{
+  if (node->obj[NODE_APP] != NULL) {
+    free_ms_obj(node->obj[NODE_APP]);
+    node->obj[NODE_APP] = NULL;
+    expire_parent(node);
+  }
+
+  if (node->pending != NULL) {
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, node->pending);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      clear_pending((struct sqlfs_node *) key);
+    }
+
+    g_hash_table_remove_all(node->pending);
+    prune_children(node);
+  }
+}
+
+/*
+ * Обход компонентов пути без разбиения строки на массив
+ */
+static struct sqlfs_node * walk_path(struct sqlfs_node *root, const char *path,
+				     gboolean create)
+{
+  const char *pn = g_path_skip_root(path);
+  if (pn == NULL)
+    return NULL;
+
+  struct sqlfs_node *node = root;
+  gchar *name = g_alloca(strlen(pn) + 1);
+
+  while (*pn && node) {
+    const char *sep = strchr(pn, G_DIR_SEPARATOR);
+    gsize len = (sep) ? (gsize) (sep - pn) : strlen(pn);
+
+    if (len > 0) {
+      memcpy(name, pn, len);
+      name[len] = '\0';
+
+      if (create)
+	node = make_child(node, name);
+      else
+	node = find_child(node, name);
+    }
+
+    pn += len;
+    if (*pn)
+      pn++;
+  }
+
+  return node;
+}
+
+struct sqlfs_node * new_tree()
+{
+  struct sqlfs_node *root = g_new0(struct sqlfs_node, 1);
+  root->name = g_strdup(G_DIR_SEPARATOR_S);
+
+  return root;
+}
+
+struct sqlfs_node * find_child(struct sqlfs_node *node, const char *name)
+{
+  if (!node || !node->children)
+    return NULL;
+
+  return g_hash_table_lookup(node->children, name);
+}
+
+struct sqlfs_node * make_child(struct sqlfs_node *node, const char *name)
+{
+  struct sqlfs_node *child = find_child(node, name);
+  if (child != NULL)
+    return child;
+
+  if (!node->children)
+    node->children = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   NULL, free_node);
+
+  child = g_new0(struct sqlfs_node, 1);
+  child->name = g_strdup(name);
+  child->parent = node;
+
+  g_hash_table_insert(node->children, child->name, child);
+
+  return child;
+}
+
+struct sqlfs_node * find_node(struct sqlfs_node *root, const char *path)
+{
+  return walk_path(root, path, FALSE);
+}
+
+struct sqlfs_node * make_node(struct sqlfs_node *root, const char *path)
+{
+  return walk_path(root, path, TRUE);
+}
+
+/*
+ * Замена объекта без удаления опустевшего узла: вызывается и при
+ * обходе дочерних узлов
+ */
+static void assign_obj(struct sqlfs_node *node, int slot,
+		       struct sqlfs_ms_obj *obj)
+{
+  gboolean changed = ((node->obj[slot] == NULL) != (obj == NULL));
+
+  if (node->obj[slot] != NULL && node->obj[slot] != obj)
+    free_ms_obj(node->obj[slot]);
+
+  node->obj[slot] = obj;
+
+  if (slot == NODE_DB && obj != NULL)
+    node->cached = g_get_monotonic_time();
+
+  if (changed && obj == NULL)
+    expire_parent(node);
+
+  if (slot == NODE_APP && changed)
+    update_pending(node);
+}
+
+void set_node_obj(struct sqlfs_node *node, int slot, struct sqlfs_ms_obj *obj)
+{
+  assign_obj(node, slot, obj);
+
+  if (obj == NULL)
+    prune_node(node);
+}
+
+struct sqlfs_ms_obj * lookup_tree(struct sqlfs_node *root, const char *path,
+				  int slot)
+{
+  struct sqlfs_node *node = find_node(root, path);
+  if (!node)
+    return NULL;
+
+  return node->obj[slot];
+}
+
+void insert_tree(struct sqlfs_node *root, const char *path, int slot,
+		 struct sqlfs_ms_obj *obj)
+{
+  struct sqlfs_node *node = make_node(root, path);
+  if (node != NULL)
+    set_node_obj(node, slot, obj);
+}
+
+struct sqlfs_ms_obj * steal_tree(struct sqlfs_node *root, const char *path,
+				 int slot)
+{
+  struct sqlfs_ms_obj *obj = NULL;
+  struct sqlfs_node *node = find_node(root, path);
+  if (node != NULL) {
+    obj = node->obj[slot];
+    node->obj[slot] = NULL;
+
+    if (obj != NULL)
+      expire_parent(node);
+
+    if (slot == NODE_APP && obj != NULL)
+      update_pending(node);
+
+    prune_node(node);
+  }
+
+  return obj;
+}
+
+gboolean remove_tree(struct sqlfs_node *root, const char *path, int slot)
+{
+  struct sqlfs_node *node = find_node(root, path);
+  if (!node || !node->obj[slot])
+    return FALSE;
+
+  set_node_obj(node, slot, NULL);
+
+  return TRUE;
+}
+
+void clear_node_dir(struct sqlfs_node *node, int slot)
+{
+  if (!node || !node->children)
+    return ;
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, node->children);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    assign_obj((struct sqlfs_node *) value, slot, NULL);
+  }
+
+  prune_children(node);
+}
+
+void remove_node_dir(struct sqlfs_node *node)
+{
+  if (!node || !node->children)
+    return ;
+
+  node->listed = 0;
+
+  g_hash_table_remove_all(node->children);
+
+  if (node->pending != NULL) {
+    g_hash_table_remove_all(node->pending);
+    update_pending(node);
+  }
+}
+
+void clear_tree(struct sqlfs_node *root, int slot)
+{
+  if (!root)
+    return ;
+
+  if (slot == NODE_APP) {
+    clear_pending(root);
+    update_pending(root);
+    return ;
+  }
+
+  assign_obj(root, slot, NULL);
+
+  if (!root->children)
+    return ;
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, root->children);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    clear_tree((struct sqlfs_node *) value, slot);
+  }
+
+  prune_children(root);
+}
+
+void free_tree(struct sqlfs_node *root)
+{
+  free_node(root);
+}
@@ -0,0 +1,129 @@
+/*
+  Copyright (C) 2013, 2014 Movsunov A.N.
+
+  This file is part of SQLFuse
+
+  SQLFuse is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SQLFuse is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SQLFuse.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSTREE_H
+#define MSTREE_H
+
+#include "msctx.h"
+
+// Слоты узла: объект из БД и объект, ожидающий сброса в БД
+#define NODE_DB 0
+#define NODE_APP 1
+
+/*
+ * Узел дерева кэша. Ключ узла - пара (родитель, имя),
+ * поэтому путь разрешается за один проход по компонентам.
+ */
+struct sqlfs_node {
+  char *name;
+  struct sqlfs_node *parent;
+
+  // дочерние узлы: имя -> struct sqlfs_node, создаётся по требованию
+  GHashTable *children;
+
+  // индекс директории: дочерние узлы, у которых есть объект NODE_APP
+  // в самом узле или во вложенных узлах
+  GHashTable *pending;
+
+  struct sqlfs_ms_obj *obj[2];
+
+  // время помещения объекта в слот NODE_DB и время последней выборки
+  // содержимого директории из БД (0 - содержимое не выбиралось)
+  gint64 cached, listed;
+};
+
+
+/*
+ * Создать корневой узел дерева
+ */
+struct sqlfs_node * new_tree();
+
+/*
+ * Найти дочерний узел по имени
+ */
+struct sqlfs_node * find_child(struct sqlfs_node *node, const char *name);
+
+/*
+ * Найти или создать дочерний узел
+ */
+struct sqlfs_node * make_child(struct sqlfs_node *node, const char *name);
+
+/*
+ * Найти узел по абсолютному пути
+ */
+struct sqlfs_node * find_node(struct sqlfs_node *root, const char *path);
+
+/*
+ * Найти узел по абсолютному пути, создавая недостающие
+ */
+struct sqlfs_node * make_node(struct sqlfs_node *root, const char *path);
+
+/*
+ * Заменить объект в слоте узла, прежний объект освобождается.
+ * Удаление объекта из слота сбрасывает время выборки родительской директории,
+ * опустевший узел (без объектов и дочерних узлов) удаляется вместе
+ * с опустевшими предками, указатель на него больше не годен.
+ */
+void set_node_obj(struct sqlfs_node *node, int slot, struct sqlfs_ms_obj *obj);
+
+/*
+ * Вернуть объект из слота по пути
+ */
+struct sqlfs_ms_obj * lookup_tree(struct sqlfs_node *root, const char *path,
+				  int slot);
+
+/*
+ * Поместить объект в слот по пути
+ */
+void insert_tree(struct sqlfs_node *root, const char *path, int slot,
+		 struct sqlfs_ms_obj *obj);
+
+/*
+ * Изъять объект из слота без освобождения памяти, опустевший узел удаляется
+ */
+struct sqlfs_ms_obj * steal_tree(struct sqlfs_node *root, const char *path,
+				 int slot);
+
+/*
+ * Удалить объект из слота
+ */
+gboolean remove_tree(struct sqlfs_node *root, const char *path, int slot);
+
+/*
+ * Очистить слот у дочерних узлов директории
+ */
+void clear_node_dir(struct sqlfs_node *node, int slot);
+
+/*
+ * Удалить все вложенные узлы директории
+ */
+void remove_node_dir(struct sqlfs_node *node);
+
+/*
+ * Очистить слот во всём дереве. Для NODE_APP обходятся
+ * только узлы из индекса pending.
+ */
+void clear_tree(struct sqlfs_node *root, int slot);
+
+/*
+ * Освободить дерево
+ */
+void free_tree(struct sqlfs_node *root);
+
+#endif
@@ -51,6 +51,9 @@ struct sqlfs_object {
   gchar *name;
   int object_id;
   unsigned int type;
+
+  // постоянный номер inode, 0 - объекта ещё нет в БД
+  guint64 ino;
   
   unsigned int len;
   gchar *def;
@@ -58,6 +61,9 @@ struct sqlfs_object {
   time_t ctime;
   time_t mtime;
   time_t cached_time;
+
+  // время жизни объекта в кэше, сек. (0 - до перечитывания директории)
+  int ttl;
 };
 
 
@@ -127,6 +133,13 @@ void remove_object(const char *path, GError **error);
 void free_sqlfs_object(gpointer object);
 
 
+/*
+ * Сбросить накопленные изменения в БД, не дожидаясь deploy_time,
+ * и дождаться окончания сброса
+ */
+void flush_deploy(GError **error);
+
+
 /*
  * Освободить память, занимаемую кэшем. Вызывается однажды.
  */